@@ -32,8 +32,15 @@ Version History
 #include <stddef.h>
 #include <limits.h>
 #include <string.h>
+#include <stdarg.h>
 //#include <cfloat.h>
 #include <float.h>
+#include <sys/mman.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 //
@@ -92,8 +99,13 @@ typedef __m256i m256i;
 // TODO (MJP): Is there a way to get these from the system?
 #define L2_CACHE_SIZE 64
 #define SYSTEM_PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2*1024*1024)
 #define KiB(s) ((s)*(1LL << 10))
 #define MiB(s) ((s)*(1LL << 20))
+#define GiB(s) ((s)*(1LL << 30))
+
+// NOTE (MJP): Alignment must be a power of 2
+#define AlignPow2(Value, Alignment) (((Value) + ((Alignment) - 1)) & ~((Alignment) - 1))
 
 
 // Assert defines
@@ -125,14 +137,122 @@ typedef __m256i m256i;
 #define NULL_INDEX_U64 0xFFFFFFFFFFFFFFFF
 
 // Zero functions 
-// TODO (MJP): Should we use a memory clear here? Faster for larger sizes?
+// NOTE (MJP): ZeroSize picks a clear by size. Small sizes (structs) are
+// cleared inline with a few overlapping scalar stores, medium sizes with
+// unaligned AVX stores, and anything bigger than the last level cache with
+// non-temporal stores, so clearing it doesn't evict everything else. Medium
+// sizes use memset unless both MJP__USE_SSE and __AVX__ are defined, large
+// sizes use memset without MJP__USE_SSE.
+#define ZERO_SIZE_INLINE_MAX 32
+// NOTE (MJP): Should be a bit bigger than the LLC of the target machine.
+#ifndef ZERO_SIZE_NON_TEMPORAL_MIN
+#define ZERO_SIZE_NON_TEMPORAL_MIN (32*1024*1024)
+#endif
+
+// NOTE (MJP): Size must be <= ZERO_SIZE_INLINE_MAX.
+inline void
+ZeroSmall_(u8 *Bytes, memory_index Size)
+{
+  u64 Zero8 = 0;
+  u32 Zero4 = 0;
+  if (Size >= 16)
+  {
+    memcpy(Bytes, &Zero8, 8);
+    memcpy(Bytes + 8, &Zero8, 8);
+    memcpy(Bytes + Size - 16, &Zero8, 8);
+    memcpy(Bytes + Size - 8, &Zero8, 8);
+  }
+  else if (Size >= 8)
+  {
+    memcpy(Bytes, &Zero8, 8);
+    memcpy(Bytes + Size - 8, &Zero8, 8);
+  }
+  else if (Size >= 4)
+  {
+    memcpy(Bytes, &Zero4, 4);
+    memcpy(Bytes + Size - 4, &Zero4, 4);
+  }
+  else
+  {
+    while(Size--)
+    {
+      *Bytes++ = 0;
+    }
+  }
+}
+
+// NOTE (MJP): Size must be > ZERO_SIZE_INLINE_MAX.
+inline void
+ZeroMedium_(u8 *Bytes, memory_index Size)
+{
+#if MJP__USE_SSE && defined(__AVX__)
+  __m256i Zero = _mm256_setzero_si256();
+  u8 *End = Bytes + Size;
+  while((End - Bytes) >= 128)
+  {
+    _mm256_storeu_si256((__m256i *)(Bytes + 0), Zero);
+    _mm256_storeu_si256((__m256i *)(Bytes + 32), Zero);
+    _mm256_storeu_si256((__m256i *)(Bytes + 64), Zero);
+    _mm256_storeu_si256((__m256i *)(Bytes + 96), Zero);
+    Bytes += 128;
+  }
+  while((End - Bytes) >= 32)
+  {
+    _mm256_storeu_si256((__m256i *)Bytes, Zero);
+    Bytes += 32;
+  }
+  if(Bytes < End)
+  {
+    // NOTE (MJP): Overlaps bytes already cleared, Size is at least 32.
+    _mm256_storeu_si256((__m256i *)(End - 32), Zero);
+  }
+#else
+  memset(Bytes, 0, Size);
+#endif
+}
+
+inline void
+ZeroLarge_(u8 *Bytes, memory_index Size)
+{
+#if MJP__USE_SSE
+  // NOTE (MJP): Regular stores for the unaligned head and tail, streaming
+  // stores for whole cache lines in between.
+  u8 *End = Bytes + Size;
+  u8 *AlignedStart = (u8 *)AlignPow2((umm)Bytes, (umm)64);
+  u8 *AlignedEnd = (u8 *)((umm)End & ~(umm)63);
+  ZeroMedium_(Bytes, 64);
+
+  __m128i Zero = _mm_setzero_si128();
+  for(u8 *Line = AlignedStart; Line < AlignedEnd; Line += 64)
+  {
+    _mm_stream_si128((__m128i *)(Line + 0), Zero);
+    _mm_stream_si128((__m128i *)(Line + 16), Zero);
+    _mm_stream_si128((__m128i *)(Line + 32), Zero);
+    _mm_stream_si128((__m128i *)(Line + 48), Zero);
+  }
+  _mm_sfence();
+
+  ZeroMedium_(End - 64, 64);
+#else
+  memset(Bytes, 0, Size);
+#endif
+}
+
 inline void
 ZeroSize (memory_index Size, void *Ptr)
 {
-  u8 *Byte = (u8 *)Ptr;
-  while(Size--)
+  u8 *Bytes = (u8 *)Ptr;
+  if(Size <= ZERO_SIZE_INLINE_MAX)
   {
-    *Byte++ = 0;
+    ZeroSmall_(Bytes, Size);
+  }
+  else if(Size < ZERO_SIZE_NON_TEMPORAL_MIN)
+  {
+    ZeroMedium_(Bytes, Size);
+  }
+  else
+  {
+    ZeroLarge_(Bytes, Size);
   }
 }
 
@@ -184,43 +304,236 @@ PointerToU32(void *Pointer)
 //
 //
 
+// NOTE (MJP): Copies are split by size like ZeroSize. Up to 32 bytes are
+// loaded into registers before anything is stored, so they are safe for any
+// overlap. Bigger copies use a vector loop in whichever direction doesn't
+// clobber unread source bytes, with the last (or first) vector loaded up front
+// so the tail can be done with one overlapping store. Without MJP__USE_SSE
+// everything goes to memcpy/memmove.
+#define COPY_SIZE_INLINE_MAX 32
+
+#if MJP__USE_SSE && defined(__AVX__)
+#define COPY_VECTOR_SIZE 32
+typedef __m256i copy_vector;
+#define CopyLoad_(Ptr) _mm256_loadu_si256((__m256i *)(Ptr))
+#define CopyStore_(Ptr, Vector) _mm256_storeu_si256((__m256i *)(Ptr), (Vector))
+#define CopyStream_(Ptr, Vector) _mm256_stream_si256((__m256i *)(Ptr), (Vector))
+#elif MJP__USE_SSE
+#define COPY_VECTOR_SIZE 16
+typedef __m128i copy_vector;
+#define CopyLoad_(Ptr) _mm_loadu_si128((__m128i *)(Ptr))
+#define CopyStore_(Ptr, Vector) _mm_storeu_si128((__m128i *)(Ptr), (Vector))
+#define CopyStream_(Ptr, Vector) _mm_stream_si128((__m128i *)(Ptr), (Vector))
+#endif
+
+// NOTE (MJP): Size must be <= COPY_SIZE_INLINE_MAX.
 inline void
-MemCopy(void *Dest, void *Source, u32 Size)
+CopySmall_(u8 *Dest, u8 *Source, memory_index Size)
 {
-  memcpy(Dest, Source, Size);
+  if (Size >= 16)
+  {
+    u64 A, B, C, D;
+    memcpy(&A, Source, 8);
+    memcpy(&B, Source + 8, 8);
+    memcpy(&C, Source + Size - 16, 8);
+    memcpy(&D, Source + Size - 8, 8);
+    memcpy(Dest, &A, 8);
+    memcpy(Dest + 8, &B, 8);
+    memcpy(Dest + Size - 16, &C, 8);
+    memcpy(Dest + Size - 8, &D, 8);
+  }
+  else if (Size >= 8)
+  {
+    u64 A, B;
+    memcpy(&A, Source, 8);
+    memcpy(&B, Source + Size - 8, 8);
+    memcpy(Dest, &A, 8);
+    memcpy(Dest + Size - 8, &B, 8);
+  }
+  else if (Size >= 4)
+  {
+    u32 A, B;
+    memcpy(&A, Source, 4);
+    memcpy(&B, Source + Size - 4, 4);
+    memcpy(Dest, &A, 4);
+    memcpy(Dest + Size - 4, &B, 4);
+  }
+  else if (Size)
+  {
+    u8 A = Source[0];
+    u8 B = Source[Size >> 1];
+    u8 C = Source[Size - 1];
+    Dest[0] = A;
+    Dest[Size >> 1] = B;
+    Dest[Size - 1] = C;
+  }
+}
+
+#if MJP__USE_SSE
+// NOTE (MJP): Safe when Dest <= Source or the ranges don't overlap.
+// Size must be > COPY_SIZE_INLINE_MAX.
+inline void
+CopyForward_(u8 *Dest, u8 *Source, memory_index Size)
+{
+  // NOTE (MJP): The ends are stored last since, with overlap, storing them
+  // first could clobber source bytes the loop has yet to read. Aligning the
+  // loop stores avoids split lines and 4K aliasing stalls.
+  copy_vector Head = CopyLoad_(Source);
+  copy_vector Tail = CopyLoad_(Source + Size - COPY_VECTOR_SIZE);
+  memory_index Offset = COPY_VECTOR_SIZE - ((umm)Dest & (COPY_VECTOR_SIZE - 1));
+  while ((Size - Offset) >= 4*COPY_VECTOR_SIZE)
+  {
+    copy_vector A = CopyLoad_(Source + Offset + 0*COPY_VECTOR_SIZE);
+    copy_vector B = CopyLoad_(Source + Offset + 1*COPY_VECTOR_SIZE);
+    copy_vector C = CopyLoad_(Source + Offset + 2*COPY_VECTOR_SIZE);
+    copy_vector D = CopyLoad_(Source + Offset + 3*COPY_VECTOR_SIZE);
+    CopyStore_(Dest + Offset + 0*COPY_VECTOR_SIZE, A);
+    CopyStore_(Dest + Offset + 1*COPY_VECTOR_SIZE, B);
+    CopyStore_(Dest + Offset + 2*COPY_VECTOR_SIZE, C);
+    CopyStore_(Dest + Offset + 3*COPY_VECTOR_SIZE, D);
+    Offset += 4*COPY_VECTOR_SIZE;
+  }
+  while ((Size - Offset) > COPY_VECTOR_SIZE)
+  {
+    CopyStore_(Dest + Offset, CopyLoad_(Source + Offset));
+    Offset += COPY_VECTOR_SIZE;
+  }
+  CopyStore_(Dest, Head);
+  CopyStore_(Dest + Size - COPY_VECTOR_SIZE, Tail);
+}
+
+// NOTE (MJP): Safe when Dest >= Source or the ranges don't overlap.
+// Size must be > COPY_SIZE_INLINE_MAX.
+inline void
+CopyBackward_(u8 *Dest, u8 *Source, memory_index Size)
+{
+  copy_vector Head = CopyLoad_(Source);
+  copy_vector Tail = CopyLoad_(Source + Size - COPY_VECTOR_SIZE);
+  memory_index Remaining = Size - (((umm)Dest + Size) & (COPY_VECTOR_SIZE - 1));
+  if (Remaining == Size)
+  {
+    Remaining -= COPY_VECTOR_SIZE;
+  }
+  while (Remaining >= 4*COPY_VECTOR_SIZE)
+  {
+    Remaining -= 4*COPY_VECTOR_SIZE;
+    copy_vector A = CopyLoad_(Source + Remaining + 3*COPY_VECTOR_SIZE);
+    copy_vector B = CopyLoad_(Source + Remaining + 2*COPY_VECTOR_SIZE);
+    copy_vector C = CopyLoad_(Source + Remaining + 1*COPY_VECTOR_SIZE);
+    copy_vector D = CopyLoad_(Source + Remaining + 0*COPY_VECTOR_SIZE);
+    CopyStore_(Dest + Remaining + 3*COPY_VECTOR_SIZE, A);
+    CopyStore_(Dest + Remaining + 2*COPY_VECTOR_SIZE, B);
+    CopyStore_(Dest + Remaining + 1*COPY_VECTOR_SIZE, C);
+    CopyStore_(Dest + Remaining + 0*COPY_VECTOR_SIZE, D);
+  }
+  while (Remaining > COPY_VECTOR_SIZE)
+  {
+    Remaining -= COPY_VECTOR_SIZE;
+    CopyStore_(Dest + Remaining, CopyLoad_(Source + Remaining));
+  }
+  CopyStore_(Dest + Size - COPY_VECTOR_SIZE, Tail);
+  CopyStore_(Dest, Head);
 }
+#endif
 
-// TODO (MJP): If we roll our own can figure out direction simply comparing pointer positions.
+// NOTE (MJP): Handles overlapping ranges, picking the direction by comparing
+// the pointers.
 inline void
-MemMove(void *Dest, void *Source, u32 Size)
+MemMove(void *Dest, void *Source, memory_index Size)
 {
+#if MJP__USE_SSE
+  u8 *DestBytes = (u8 *)Dest;
+  u8 *SourceBytes = (u8 *)Source;
+  if (Size <= COPY_SIZE_INLINE_MAX)
+  {
+    CopySmall_(DestBytes, SourceBytes, Size);
+  }
+  else if ((umm)(DestBytes - SourceBytes) >= (umm)Size)
+  {
+    // NOTE (MJP): Dest is before Source, or after the end of it.
+    CopyForward_(DestBytes, SourceBytes, Size);
+  }
+  else
+  {
+    CopyBackward_(DestBytes, SourceBytes, Size);
+  }
+#else
   memmove(Dest, Source, Size);
+#endif
+}
+
+// NOTE (MJP): Overlap is fine here too, MemCopy is only kept as a separate
+// name so callers can say they don't expect it.
+inline void
+MemCopy(void *Dest, void *Source, memory_index Size)
+{
+  MemMove(Dest, Source, Size);
 }
 
 // NOTE: (Kapsy) Copies in reverse so we can move data right without overwriting
-// TODO (MJP) Should really become a MemMove
 inline void
-MemCopyRev (void *from, void *to, u32 size)
+MemCopyRev (void *from, void *to, memory_index size)
 {
-    // move one byte back
-    // although, this is ugly, will rewrite with simd at some point
-    u8 *frombytes = ((u8 *) from) + size - 1;
-    u8 *tobytes = ((u8 *) to) + size - 1;
+#if MJP__USE_SSE
+  if (size <= COPY_SIZE_INLINE_MAX)
+  {
+    CopySmall_((u8 *)to, (u8 *)from, size);
+  }
+  else
+  {
+    CopyBackward_((u8 *)to, (u8 *)from, size);
+  }
+#else
+  memmove(to, from, size);
+#endif
+}
 
-    for(u32 i=0 ; i<size ; i++)
-    {
-        *tobytes-- = *frombytes--;
-    }
+inline void
+Copy(void *From, void *To, memory_index Size)
+{
+  MemMove(To, From, Size);
 }
 
-// TODO: (Kapsy) Switch to this!
+// NOTE (MJP): Copy for big destinations that won't be read again soon, e.g.
+// rendering out a sample bank. Whole cache lines of Dest are written with
+// non-temporal stores so they don't evict the working set. Dest and Source
+// must not overlap. Small copies are not worth it and go through MemCopy.
+#define COPY_STREAM_MIN 4096
+
 inline void
-Copy(void *From, void *To, u32 Size)
+MemCopyStream(void *Dest, void *Source, memory_index Size)
 {
-    u8 *FromBytes = (u8 *)From;
-    u8 *ToBytes = (u8 *)To;
+#if MJP__USE_SSE
+  if (Size < COPY_STREAM_MIN)
+  {
+    MemCopy(Dest, Source, Size);
+    return;
+  }
+
+  u8 *DestBytes = (u8 *)Dest;
+  u8 *SourceBytes = (u8 *)Source;
+  Assert(((DestBytes + Size) <= SourceBytes) || ((SourceBytes + Size) <= DestBytes));
 
-    while(Size--) { *ToBytes++ = *FromBytes++; }
+  memory_index HeadSize = (memory_index)(AlignPow2((umm)DestBytes, (umm)64) - (umm)DestBytes);
+  memory_index LineBytes = (Size - HeadSize) & ~(memory_index)63;
+  MemCopy(DestBytes, SourceBytes, HeadSize);
+
+  u8 *DestLine = DestBytes + HeadSize;
+  u8 *SourceLine = SourceBytes + HeadSize;
+  for (memory_index Offset = 0; Offset < LineBytes; Offset += 64)
+  {
+    for (u32 Part = 0; Part < 64; Part += COPY_VECTOR_SIZE)
+    {
+      CopyStream_(DestLine + Offset + Part, CopyLoad_(SourceLine + Offset + Part));
+    }
+  }
+  _mm_sfence();
+
+  memory_index Done = HeadSize + LineBytes;
+  MemCopy(DestBytes + Done, SourceBytes + Done, Size - Done);
+#else
+  memcpy(Dest, Source, Size);
+#endif
 }
 
 inline s32
@@ -398,18 +711,69 @@ FindLeastSignificantSetBit(u32 Value)
 
 #if COMPILER_MSVC
     Result.Found = _BitScanForward(&Result.Index, Value);
-// TODO: (Kapsy) LLVM!
 #else
-    for(u32 Test = 0;
-            Test < 32;
-            ++Test)
+    if(Value)
     {
-        if(Value & (1 << Test))
-        {
-            Result.Index = Test;
-            Result.Found = true;
-            break;
-        }
+        Result.Index = __builtin_ctz(Value);
+        Result.Found = true;
+    }
+#endif
+
+    return(Result);
+}
+
+inline bit_scan_result
+FindMostSignificantSetBit(u32 Value)
+{
+    bit_scan_result Result = {};
+
+#if COMPILER_MSVC
+    Result.Found = _BitScanReverse(&Result.Index, Value);
+#else
+    if(Value)
+    {
+        Result.Index = 31 - __builtin_clz(Value);
+        Result.Found = true;
+    }
+#endif
+
+    return(Result);
+}
+
+inline bit_scan_result
+FindLeastSignificantSetBit(u64 Value)
+{
+    bit_scan_result Result = {};
+
+#if COMPILER_MSVC
+    unsigned long Index;
+    Result.Found = _BitScanForward64(&Index, Value);
+    Result.Index = Index;
+#else
+    if(Value)
+    {
+        Result.Index = __builtin_ctzll(Value);
+        Result.Found = true;
+    }
+#endif
+
+    return(Result);
+}
+
+inline bit_scan_result
+FindMostSignificantSetBit(u64 Value)
+{
+    bit_scan_result Result = {};
+
+#if COMPILER_MSVC
+    unsigned long Index;
+    Result.Found = _BitScanReverse64(&Index, Value);
+    Result.Index = Index;
+#else
+    if(Value)
+    {
+        Result.Index = 63 - __builtin_clzll(Value);
+        Result.Found = true;
     }
 #endif
 
@@ -2786,6 +3150,47 @@ AtomicDecrement(u32 volatile *TheValue)
 }
 
 
+// NOTE (MJP): Test and test-and-set spin lock. It's not fair, but a fair
+// (ticket) lock falls apart as soon as there are more threads than cores,
+// since every handoff then waits on one particular thread being scheduled.
+#define SPIN_MUTEX_SPIN_COUNT 64
+
+struct spin_mutex
+{
+   u32 volatile Locked;
+};
+
+inline void
+BeginSpinMutex(spin_mutex *Mutex)
+{
+   u32 SpinCount = 0;
+   while (!AtomicCompareAndSwapBool(&Mutex->Locked, 0, 1))
+   {
+      while (AtomicLoad(&Mutex->Locked))
+      {
+         // NOTE (MJP): Give up the core after a while, in case the holder has
+         // been preempted.
+         if (++SpinCount < SPIN_MUTEX_SPIN_COUNT)
+         {
+#if MJP__USE_SSE
+            _mm_pause();
+#endif
+         }
+         else
+         {
+            sched_yield();
+            SpinCount = 0;
+         }
+      }
+   }
+}
+
+inline void
+EndSpinMutex(spin_mutex *Mutex)
+{
+   __atomic_store_n(&Mutex->Locked, 0, __ATOMIC_RELEASE);
+}
+
 // 
 // SECTION: ATOMIC RING BUFFER STATE
 //
@@ -2871,431 +3276,5763 @@ Empty(ring_buffer_state State)
 // 
 // 
 
+// NOTE (MJP): Virtual memory wrappers. Reserved memory is address space only,
+// and has to be committed before it's touched. Sizes and addresses should be
+// multiples of SYSTEM_PAGE_SIZE.
 
+// NOTE (MJP): Virtual memory flags
+// Align the reservation to HUGE_PAGE_SIZE and ask for transparent huge pages.
+#define MEMORY_FLAG_HUGE_PAGES (1 << 0)
+// Fault committed pages in straight away rather than on first touch.
+#define MEMORY_FLAG_PREFAULT (1 << 1)
+// Lock committed pages in RAM (implies PREFAULT). Falls back to PREFAULT if
+// the lock limit (RLIMIT_MEMLOCK) is hit.
+#define MEMORY_FLAG_LOCK (1 << 2)
 
+function void *
+ReserveMemory(memory_index Size, u32 Flags = 0)
+{
+   s32 MapFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+   MapFlags |= MAP_NORESERVE;
+#endif
 
+   // NOTE (MJP): Over reserve so the block can be trimmed to a huge page
+   // boundary, the kernel only uses huge pages for aligned 2 MiB ranges.
+   memory_index MappedSize = Size;
+   if (GetFlag(Flags, MEMORY_FLAG_HUGE_PAGES))
+   {
+      MappedSize += HUGE_PAGE_SIZE;
+   }
 
-// 
-// SECTION: STRINGS
-// 
-//
-
-
-
+   u8 *Memory = (u8 *)mmap(0, MappedSize, PROT_NONE, MapFlags, -1, 0);
+   if (Memory == MAP_FAILED)
+   {
+      Memory = 0;
+   }
+   else if (GetFlag(Flags, MEMORY_FLAG_HUGE_PAGES))
+   {
+      u8 *Aligned = (u8 *)AlignPow2((umm)Memory, (umm)HUGE_PAGE_SIZE);
+      memory_index HeadSize = Aligned - Memory;
+      memory_index TailSize = MappedSize - HeadSize - Size;
+      if (HeadSize)
+      {
+         munmap(Memory, HeadSize);
+      }
+      if (TailSize)
+      {
+         munmap(Aligned + Size, TailSize);
+      }
+      Memory = Aligned;
+#ifdef MADV_HUGEPAGE
+      madvise(Memory, Size, MADV_HUGEPAGE);
+#endif
+   }
+   return(Memory);
+}
 
-// TODO Replace with String8 like implementation
-inline int
-StringLength(char *String)
+function void
+PrefaultMemory(void *Memory, memory_index Size)
 {
-    int Count = 0;
-    while(*String++)
-    {
-        ++Count;
-    }
-    return(Count);
+   b32 Populated = false;
+#ifdef MADV_POPULATE_WRITE
+   Populated = (madvise(Memory, Size, MADV_POPULATE_WRITE) == 0);
+#endif
+   if (!Populated)
+   {
+      // NOTE (MJP): Writing back what's there faults the page in without
+      // changing it.
+      u8 volatile *Bytes = (u8 volatile *)Memory;
+      for (memory_index Offset = 0; Offset < Size; Offset += SYSTEM_PAGE_SIZE)
+      {
+         Bytes[Offset] = Bytes[Offset];
+      }
+   }
 }
 
-// TODO (MJP): Use RJF String8 like functions
-inline u32
-CatStrings (char *a, char *b, char *out)
+function b32
+CommitMemory(void *Memory, memory_index Size, u32 Flags = 0)
 {
-    char *outat = out;
-
-    char *aat = a;
-    u32 alen = StringLength(a);
-
-    char *bat = b;
-    u32 blen = StringLength(b);
-
-    for (u32 i=0 ; i<alen ; i++)
-        *outat++ = *aat++;
-        
-    for (u32 i=0 ; i<blen ; i++)
-        *outat++ = *bat++;
+   b32 Committed = (mprotect(Memory, Size, PROT_READ | PROT_WRITE) == 0);
+   if (Committed)
+   {
+      b32 Locked = false;
+      if (GetFlag(Flags, MEMORY_FLAG_LOCK))
+      {
+         Locked = (mlock(Memory, Size) == 0);
+      }
+      if (!Locked && GetFlag(Flags, MEMORY_FLAG_LOCK | MEMORY_FLAG_PREFAULT))
+      {
+         PrefaultMemory(Memory, Size);
+      }
+   }
+   return(Committed);
+}
 
-    u32 res = (u32) (outat - out);
+// NOTE (MJP): Gives the physical pages back to the OS, the range reads as
+// zero if it's committed again.
+function void
+DecommitMemory(void *Memory, memory_index Size, u32 Flags = 0)
+{
+   if (GetFlag(Flags, MEMORY_FLAG_LOCK))
+   {
+      munlock(Memory, Size);
+   }
+   madvise(Memory, Size, MADV_DONTNEED);
+   mprotect(Memory, Size, PROT_NONE);
+}
 
-    return (res);
+function void
+ReleaseMemory(void *Memory, memory_index Size)
+{
+   munmap(Memory, Size);
 }
 
-#ifdef RJF_LIBS
-//
-// SECTION: CHUNK ALLOCATOR
-//
-// This is a basic heap allocator, that operates with a fixed chunk size to
-// reduce fragmentation and the realloc frequency. 
-//
-// Allocates from a Arena (that should be expandable using virtual alloc etc) for now.
-//
-// TODO (MJP): To be honest, I don't know if it's faster than 8 aligned
-// allocations, and might well be. Need to make the chunk/alignment size
-// adjustable, so implementer can decide based on use case.
-//
+// NOTE (MJP): Linear arena. Either owns a reserved block of address space
+// that is committed as it fills up (ArenaAlloc), or wraps memory the caller
+// already has (InitializeArena). Pushes bump Used, and the only way to free
+// is to pop back to an earlier position.
 
-// NOTE (MJP): Chunk allocator types
-#define CHUNK_ALLOCATOR_CHUNK_SIZE 64
-#define CHUNK_ALLOCATOR_CHUNK_COUNT (1 << 18)
+#define ARENA_DEFAULT_RESERVE_SIZE GiB(1)
+#define ARENA_COMMIT_SIZE KiB(64)
+#define ARENA_DEFAULT_ALIGNMENT 16
 
-struct chunk_region
+struct memory_arena
 {
-   chunk_region *Next;
-   chunk_region *Prev;
-   u32  StartIndex;
-   u32  Count;
+   u8 *Base;
+   memory_index Size;
+   memory_index CommittedSize;
+   memory_index Used;
+
+   // NOTE (MJP): Set for arenas from ArenaAlloc, which own their memory.
+   b32 IsReserved;
+   // NOTE (MJP): MEMORY_FLAG_ values the arena's memory is committed with.
+   u32 Flags;
+   s32 TempCount;
 };
 
-struct chunk_allocator
+struct temporary_memory
 {
-   // NOTE (MJP): Ordered list for tracking free regions, not to be confused
-   // with FreeListSentinel
-   chunk_region *FreeRegionsSentinel;
-   chunk_region *AllocatedRegionsSentinel;
-
-   // NOTE (MJP): For recycling chunk_regions, NOT tracking free regions
-   chunk_region *FreeListSentinel;
-
-   M_Arena *Arena;
-
-   // TODO (MJP): For now, will allocate up front from same arena, but would
-   // like to be expandable, so will probably have a different arena for chunk
-   // memory and allocation meta members.
-   u8 *ChunkMemory;
+   memory_arena *Arena;
+   memory_index Used;
 };
 
-function u32
-GetChunkCount(u32 SizeBytes)
+function void
+InitializeArena(memory_arena *Arena, memory_index Size, void *Base)
 {
-   u32 ChunkCount =
-      (SizeBytes + (CHUNK_ALLOCATOR_CHUNK_SIZE - 1))/CHUNK_ALLOCATOR_CHUNK_SIZE;
-   return(ChunkCount);
+   ZeroStruct(*Arena);
+   Arena->Base = (u8 *)Base;
+   Arena->Size = Size;
+   Arena->CommittedSize = Size;
 }
 
-function u32
-GetSizeBytes(u32 ChunkCount)
+// NOTE (MJP): With MEMORY_FLAG_PREFAULT or MEMORY_FLAG_LOCK the whole
+// reservation is committed (and faulted in) here, so pushes never fault
+// later. Size the reservation for what's actually needed in that case.
+function b32
+ArenaAlloc(memory_arena *Arena, memory_index ReserveSize = ARENA_DEFAULT_RESERVE_SIZE,
+           u32 Flags = 0)
 {
-   u32 SizeBytes = ChunkCount*CHUNK_ALLOCATOR_CHUNK_SIZE;
-   return(SizeBytes);
-}
-
-function void
-InsertRegionInOrder(chunk_region *Sentinel, chunk_region *ChunkRegion)
-{
-   chunk_region *NextRegion = Sentinel->Next;
-   for (; NextRegion != Sentinel;
-          NextRegion = NextRegion->Next)
+   ZeroStruct(*Arena);
+   ReserveSize = AlignPow2(ReserveSize, (memory_index)SYSTEM_PAGE_SIZE);
+   Arena->Base = (u8 *)ReserveMemory(ReserveSize, Flags);
+   if (Arena->Base)
    {
-      if (NextRegion->StartIndex > ChunkRegion->StartIndex)
+      Arena->Size = ReserveSize;
+      Arena->IsReserved = true;
+      Arena->Flags = Flags;
+
+      if (GetFlag(Flags, MEMORY_FLAG_PREFAULT | MEMORY_FLAG_LOCK))
       {
-         break;
+         if (CommitMemory(Arena->Base, Arena->Size, Flags))
+         {
+            Arena->CommittedSize = Arena->Size;
+         }
       }
    }
-   SDLLInsertBefore(NextRegion, ChunkRegion);
+   return(Arena->Base != 0);
 }
 
-function chunk_region *
-NewChunkRegion(chunk_allocator *ChunkAllocator, u32 StartIndex, u32 Count)
+function void
+ArenaRelease(memory_arena *Arena)
 {
-   chunk_region *ChunkRegion = 0;
-   SDLLAlloc(ChunkRegion, ChunkAllocator->FreeListSentinel,
-             RJF_PushArray(ChunkAllocator->Arena, chunk_region, 1));
-   Assert(ChunkRegion);
-   ZeroStruct(*ChunkRegion);
-
-   ChunkRegion->StartIndex = StartIndex;
-   ChunkRegion->Count = Count;
+   if (Arena->IsReserved)
+   {
+      ReleaseMemory(Arena->Base, Arena->Size);
+   }
+   ZeroStruct(*Arena);
+}
 
-   return(ChunkRegion);
+inline memory_index
+GetAlignmentOffset(memory_arena *Arena, memory_index Alignment)
+{
+   memory_index ResultPointer = (memory_index)Arena->Base + Arena->Used;
+   memory_index AlignmentOffset = AlignPow2(ResultPointer, Alignment) - ResultPointer;
+   return(AlignmentOffset);
 }
 
-function void
-RemoveChunkRegion(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+inline memory_index
+GetArenaSizeRemaining(memory_arena *Arena, memory_index Alignment = ARENA_DEFAULT_ALIGNMENT)
 {
-   SDLLRemove(ChunkRegion);
-   SDLLInsertAfter(ChunkAllocator->FreeListSentinel, ChunkRegion);
+   memory_index Result = Arena->Size - (Arena->Used + GetAlignmentOffset(Arena, Alignment));
+   return(Result);
 }
 
+// NOTE (MJP): Returns 0 if the arena is out of space (or commit fails), in
+// all builds. Callers must check.
+function void *
+PushSize_(memory_arena *Arena, memory_index Size, memory_index Alignment = ARENA_DEFAULT_ALIGNMENT)
+{
+   Assert(Alignment && !(Alignment & (Alignment - 1)));
+
+   void *Result = 0;
+   memory_index AlignmentOffset = GetAlignmentOffset(Arena, Alignment);
+   memory_index Remaining = Arena->Size - Arena->Used;
+
+   // NOTE (MJP): Compared against what's left so a huge Size can't wrap.
+   if ((AlignmentOffset <= Remaining) && (Size <= (Remaining - AlignmentOffset)))
+   {
+      memory_index NewUsed = Arena->Used + AlignmentOffset + Size;
+      b32 Committed = true;
+      if (NewUsed > Arena->CommittedSize)
+      {
+         memory_index CommitSize = GetFlag(Arena->Flags, MEMORY_FLAG_HUGE_PAGES) ?
+            HUGE_PAGE_SIZE : ARENA_COMMIT_SIZE;
+         memory_index NewCommittedSize = Min(AlignPow2(NewUsed, CommitSize), Arena->Size);
+         Committed = CommitMemory(Arena->Base + Arena->CommittedSize,
+                                  NewCommittedSize - Arena->CommittedSize, Arena->Flags);
+         if (Committed)
+         {
+            Arena->CommittedSize = NewCommittedSize;
+         }
+      }
+
+      if (Committed)
+      {
+         Result = Arena->Base + Arena->Used + AlignmentOffset;
+         Arena->Used = NewUsed;
+      }
+   }
+
+   return(Result);
+}
 
 function void *
-GetMemoryAddress(chunk_allocator *Allocator, u32 ChunkIndex)
+PushSizeZero_(memory_arena *Arena, memory_index Size, memory_index Alignment = ARENA_DEFAULT_ALIGNMENT)
 {
-   void *Address =
-      (void *) (Allocator->ChunkMemory +
-       ChunkIndex*CHUNK_ALLOCATOR_CHUNK_SIZE);
-   Assert(Address);
-   return(Address);
+   void *Result = PushSize_(Arena, Size, Alignment);
+   if (Result)
+   {
+      ZeroSize(Size, Result);
+   }
+   return(Result);
 }
 
+#define PushSize(Arena, Size, ...) PushSize_((Arena), (Size), ## __VA_ARGS__)
+#define PushStruct(Arena, Type, ...) (Type *)PushSize_((Arena), SizeOf(Type), ## __VA_ARGS__)
+#define PushArray(Arena, Type, Count, ...) (Type *)PushSize_((Arena), SizeOf(Type)*(Count), ## __VA_ARGS__)
+#define PushStructZero(Arena, Type, ...) (Type *)PushSizeZero_((Arena), SizeOf(Type), ## __VA_ARGS__)
+#define PushArrayZero(Arena, Type, Count, ...) (Type *)PushSizeZero_((Arena), SizeOf(Type)*(Count), ## __VA_ARGS__)
+
 function void *
-GetMemoryAddress(chunk_allocator *Allocator, chunk_region *ChunkRegion)
+PushCopy(memory_arena *Arena, memory_index Size, void *Source,
+         memory_index Alignment = ARENA_DEFAULT_ALIGNMENT)
 {
-   void *Address =
-      (void *) (Allocator->ChunkMemory +
-       ChunkRegion->StartIndex*CHUNK_ALLOCATOR_CHUNK_SIZE);
-   Assert(Address);
-   return(Address);
+   void *Result = PushSize_(Arena, Size, Alignment);
+   if (Result)
+   {
+      memcpy(Result, Source, Size);
+   }
+   return(Result);
 }
 
-function chunk_region *
-GetAllocatedRegion(chunk_allocator *ChunkAllocator, void *RegionStartAddress)
+inline memory_index
+GetArenaPos(memory_arena *Arena)
 {
-   chunk_region *FoundAllocatedRegion = 0;
+   return(Arena->Used);
+}
 
-   u32 ChunkStartIndex = 
-      (u32)(((memory_index)RegionStartAddress -
-             (memory_index)ChunkAllocator->ChunkMemory)/
-             CHUNK_ALLOCATOR_CHUNK_SIZE);
+// NOTE (MJP): Committed memory is kept, so refilling the arena is free.
+inline void
+ArenaPopTo(memory_arena *Arena, memory_index Pos)
+{
+   Assert(Pos <= Arena->Used);
+   Arena->Used = Pos;
+}
 
-   // TODO (MJP): Dictionary is probably better than iterating like this every time.
-   for (chunk_region *AllocatedRegion = ChunkAllocator->AllocatedRegionsSentinel->Next;
-                      AllocatedRegion != ChunkAllocator->AllocatedRegionsSentinel;
-                      AllocatedRegion = AllocatedRegion->Next)
-   {
-      if (AllocatedRegion->StartIndex == ChunkStartIndex)
-      {
-         FoundAllocatedRegion = AllocatedRegion;
-         break;
-      }
-   }
-   return(FoundAllocatedRegion);
+inline void
+ArenaClear(memory_arena *Arena)
+{
+   ArenaPopTo(Arena, 0);
 }
 
-function void
-MergeNeighboringFreeRegions(chunk_allocator *ChunkAllocator)
+inline temporary_memory
+BeginTemporaryMemory(memory_arena *Arena)
 {
+   temporary_memory Result;
+   Result.Arena = Arena;
+   Result.Used = Arena->Used;
+   ++Arena->TempCount;
+   return(Result);
+}
 
+inline void
+EndTemporaryMemory(temporary_memory TempMem)
+{
+   memory_arena *Arena = TempMem.Arena;
+   Assert(Arena->TempCount > 0);
+   ArenaPopTo(Arena, TempMem.Used);
+   --Arena->TempCount;
 }
 
-function void
-SetupAllocator(chunk_allocator *ChunkAllocator)
+inline void
+CheckArena(memory_arena *Arena)
 {
-   ChunkAllocator->Arena = M_ArenaAlloc((1 << 20)*80);
+   (void)Arena;
+   Assert(Arena->TempCount == 0);
+}
 
-   u32 ChunkMemorySize =
-      CHUNK_ALLOCATOR_CHUNK_SIZE*CHUNK_ALLOCATOR_CHUNK_COUNT;
-   ChunkAllocator->ChunkMemory =
-      (u8 *)M_ArenaPushAligned(ChunkAllocator->Arena,
-                               ChunkMemorySize, L2_CACHE_SIZE);
+#if defined(__linux__)
+// NOTE (MJP): Copy on write arena snapshots (Linux only). The arena is a
+// MAP_PRIVATE mapping of a memfd, and the memfd holds the last snapshot. A
+// page the arena has written since then is a private (anonymous) copy, which
+// /proc/self/pagemap tells apart from a page still backed by the file. So:
+//
+//    TakeArenaSnapshot writes the private pages back to the memfd and drops
+//    them, the arena then reads the new snapshot through the page cache.
+//    RestoreArenaSnapshot just drops the private pages.
+//
+// Both cost O(pages touched since the last snapshot), plus a scan of 8 bytes
+// of pagemap per committed page. Only the latest snapshot is kept.
+
+#define ARENA_SNAPSHOT_PAGEMAP_BATCH 512
+#define PAGEMAP_PRESENT (1ULL << 63)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_FILE_OR_SHARED (1ULL << 61)
+
+struct arena_snapshot
+{
+   s32 File;
+   s32 PagemapFile;
+   memory_index Used;
+};
 
-   ChunkAllocator->AllocatedRegionsSentinel = 
-      RJF_PushArray(ChunkAllocator->Arena, chunk_region, 1);
-   ChunkAllocator->AllocatedRegionsSentinel->Next = 
-   ChunkAllocator->AllocatedRegionsSentinel->Prev = 
-   ChunkAllocator->AllocatedRegionsSentinel;
+function b32
+ArenaAllocWithSnapshots(memory_arena *Arena, arena_snapshot *Snapshot,
+                        memory_index ReserveSize = ARENA_DEFAULT_RESERVE_SIZE)
+{
+   ZeroStruct(*Arena);
+   ZeroStruct(*Snapshot);
+   ReserveSize = AlignPow2(ReserveSize, (memory_index)SYSTEM_PAGE_SIZE);
 
-   ChunkAllocator->FreeRegionsSentinel = 
-      RJF_PushArray(ChunkAllocator->Arena, chunk_region, 1);
-   ChunkAllocator->FreeRegionsSentinel->Next = 
-   ChunkAllocator->FreeRegionsSentinel->Prev = 
-   ChunkAllocator->FreeRegionsSentinel;
+   Snapshot->File = memfd_create("mjp_arena_snapshot", MFD_CLOEXEC);
+   Snapshot->PagemapFile = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
 
-   ChunkAllocator->FreeListSentinel = 
-      RJF_PushArray(ChunkAllocator->Arena, chunk_region, 1);
-   ChunkAllocator->FreeListSentinel->Next = 
-   ChunkAllocator->FreeListSentinel->Prev = 
-   ChunkAllocator->FreeListSentinel;
+   b32 Allocated = false;
+   if ((Snapshot->File >= 0) && (Snapshot->PagemapFile >= 0) &&
+       (ftruncate(Snapshot->File, ReserveSize) == 0))
+   {
+      s32 MapFlags = MAP_PRIVATE;
+#ifdef MAP_NORESERVE
+      MapFlags |= MAP_NORESERVE;
+#endif
+      void *Memory = mmap(0, ReserveSize, PROT_NONE, MapFlags, Snapshot->File, 0);
+      if (Memory != MAP_FAILED)
+      {
+         Arena->Base = (u8 *)Memory;
+         Arena->Size = ReserveSize;
+         Arena->IsReserved = true;
+         Allocated = true;
+      }
+   }
 
-   // Setup the first free region
-   chunk_region *FreeRegion =
-      NewChunkRegion(ChunkAllocator, 0, CHUNK_ALLOCATOR_CHUNK_COUNT);
-   InsertRegionInOrder(ChunkAllocator->FreeRegionsSentinel, FreeRegion);
+   if (!Allocated)
+   {
+      if (Snapshot->File >= 0)
+      {
+         close(Snapshot->File);
+      }
+      if (Snapshot->PagemapFile >= 0)
+      {
+         close(Snapshot->PagemapFile);
+      }
+      ZeroStruct(*Snapshot);
+      Snapshot->File = Snapshot->PagemapFile = -1;
+   }
+   return(Allocated);
 }
 
 function void
-CheckForClashingRegions(chunk_allocator *ChunkAllocator)
+ArenaReleaseWithSnapshots(memory_arena *Arena, arena_snapshot *Snapshot)
 {
-   for (chunk_region *AllocatedRegion = ChunkAllocator->AllocatedRegionsSentinel->Next;
-                      AllocatedRegion != ChunkAllocator->AllocatedRegionsSentinel;
-                      AllocatedRegion = AllocatedRegion->Next)
+   ArenaRelease(Arena);
+   if (Snapshot->File >= 0)
+   {
+      close(Snapshot->File);
+   }
+   if (Snapshot->PagemapFile >= 0)
    {
-      u32 AllocatedRegionChunkStartIndex = AllocatedRegion->StartIndex;
-      u32 AllocatedRegionChunkOPEIndex = AllocatedRegion->StartIndex + AllocatedRegion->Count;
+      close(Snapshot->PagemapFile);
+   }
+   ZeroStruct(*Snapshot);
+   Snapshot->File = Snapshot->PagemapFile = -1;
+}
 
-      for (chunk_region *TestRegion = AllocatedRegion->Next;
-            TestRegion != ChunkAllocator->AllocatedRegionsSentinel;
-            TestRegion = TestRegion->Next)
-      {
-         u32 TestRegionChunkStartIndex = TestRegion->StartIndex;
-         u32 TestRegionChunkOPEIndex = TestRegion->StartIndex + TestRegion->Count;
+// NOTE (MJP): Calls Handler(Arena, Snapshot, PageIndex, PageCount) for every
+// run of pages in the committed part of the arena that has been written since
+// the last snapshot. Returns the number of such pages.
+typedef void arena_dirty_run_handler(memory_arena *Arena, arena_snapshot *Snapshot,
+                                     memory_index PageIndex, memory_index PageCount);
 
-         Assert(((TestRegionChunkStartIndex >= AllocatedRegionChunkOPEIndex) &&
-                 (TestRegionChunkOPEIndex >= AllocatedRegionChunkOPEIndex)) ||
-                ((TestRegionChunkStartIndex <= AllocatedRegionChunkStartIndex) &&
-                 (TestRegionChunkOPEIndex <= AllocatedRegionChunkStartIndex)));
-      }
+function memory_index
+ForEachDirtyRun(memory_arena *Arena, arena_snapshot *Snapshot, arena_dirty_run_handler *Handler)
+{
+   memory_index DirtyPageCount = 0;
+   memory_index PageCount = Arena->CommittedSize / SYSTEM_PAGE_SIZE;
+   memory_index FirstPage = (memory_index)Arena->Base / SYSTEM_PAGE_SIZE;
 
-      for (chunk_region *TestRegion = ChunkAllocator->FreeRegionsSentinel->Next;
-                         TestRegion != ChunkAllocator->FreeRegionsSentinel;
-                         TestRegion = TestRegion->Next)
+   u64 Entries[ARENA_SNAPSHOT_PAGEMAP_BATCH];
+   memory_index RunStart = 0;
+   memory_index RunCount = 0;
+   for (memory_index BatchStart = 0; BatchStart < PageCount; BatchStart += ARENA_SNAPSHOT_PAGEMAP_BATCH)
+   {
+      memory_index BatchCount = Min((memory_index)ARENA_SNAPSHOT_PAGEMAP_BATCH, PageCount - BatchStart);
+      ssize_t ReadSize = pread(Snapshot->PagemapFile, Entries, BatchCount*SizeOf(u64),
+                               (off_t)((FirstPage + BatchStart)*SizeOf(u64)));
+      AssertPrint(ReadSize == (ssize_t)(BatchCount*SizeOf(u64)), "Couldn't read /proc/self/pagemap");
+      if (ReadSize != (ssize_t)(BatchCount*SizeOf(u64)))
       {
-         u32 TestRegionChunkStartIndex = TestRegion->StartIndex;
-         u32 TestRegionChunkOPEIndex = TestRegion->StartIndex + TestRegion->Count;
+         break;
+      }
 
-         Assert(((TestRegionChunkStartIndex >= AllocatedRegionChunkOPEIndex) &&
-                 (TestRegionChunkOPEIndex >= AllocatedRegionChunkOPEIndex)) ||
-                ((TestRegionChunkStartIndex <= AllocatedRegionChunkStartIndex) &&
-                 (TestRegionChunkOPEIndex <= AllocatedRegionChunkStartIndex)));
+      for (memory_index EntryIndex = 0; EntryIndex < BatchCount; ++EntryIndex)
+      {
+         u64 Entry = Entries[EntryIndex];
+         b32 IsDirty = (GetFlag(Entry, PAGEMAP_PRESENT) && !GetFlag(Entry, PAGEMAP_FILE_OR_SHARED)) ||
+                       GetFlag(Entry, PAGEMAP_SWAPPED);
+         if (IsDirty)
+         {
+            if (!RunCount)
+            {
+               RunStart = BatchStart + EntryIndex;
+            }
+            ++RunCount;
+         }
+         else if (RunCount)
+         {
+            Handler(Arena, Snapshot, RunStart, RunCount);
+            DirtyPageCount += RunCount;
+            RunCount = 0;
+         }
       }
    }
 
-   for (chunk_region *FreeRegion = ChunkAllocator->FreeRegionsSentinel->Next;
-                      FreeRegion != ChunkAllocator->FreeRegionsSentinel;
-                      FreeRegion = FreeRegion->Next)
+   if (RunCount)
    {
-      u32 FreeRegionChunkStartIndex = FreeRegion->StartIndex;
-      u32 FreeRegionChunkOPEIndex = FreeRegion->StartIndex + FreeRegion->Count;
+      Handler(Arena, Snapshot, RunStart, RunCount);
+      DirtyPageCount += RunCount;
+   }
+   return(DirtyPageCount);
+}
 
-      for (chunk_region *TestRegion = FreeRegion->Next;
-                         TestRegion != ChunkAllocator->FreeRegionsSentinel;
-                         TestRegion = TestRegion->Next)
+function void
+WriteBackDirtyRun(memory_arena *Arena, arena_snapshot *Snapshot,
+                  memory_index PageIndex, memory_index PageCount)
+{
+   memory_index Offset = PageIndex*SYSTEM_PAGE_SIZE;
+   memory_index Size = PageCount*SYSTEM_PAGE_SIZE;
+   memory_index Written = 0;
+   while (Written < Size)
+   {
+      ssize_t Result = pwrite(Snapshot->File, Arena->Base + Offset + Written, Size - Written,
+                              (off_t)(Offset + Written));
+      AssertPrint(Result > 0, "Couldn't write arena snapshot");
+      if (Result <= 0)
       {
-         u32 TestRegionChunkStartIndex = TestRegion->StartIndex;
-         u32 TestRegionChunkOPEIndex = TestRegion->StartIndex + TestRegion->Count;
-
-         Assert(((TestRegionChunkStartIndex >= FreeRegionChunkOPEIndex) &&
-                 (TestRegionChunkOPEIndex >= FreeRegionChunkOPEIndex)) ||
-                ((TestRegionChunkStartIndex <= FreeRegionChunkStartIndex) &&
-                 (TestRegionChunkOPEIndex <= FreeRegionChunkStartIndex)));
+         break;
       }
+      Written += Result;
    }
+   madvise(Arena->Base + Offset, Size, MADV_DONTNEED);
 }
 
-function chunk_region *
-AllocateChunkRegion(chunk_allocator *ChunkAllocator, u32 ChunkCount)
+function void
+DropDirtyRun(memory_arena *Arena, arena_snapshot *Snapshot,
+             memory_index PageIndex, memory_index PageCount)
 {
-   Assert(ChunkCount);
-   Assert(ChunkAllocator->ChunkMemory);
+   // NOTE (MJP): Snapshot is only there to match WriteBackDirtyRun.
+   (void)Snapshot;
+   madvise(Arena->Base + PageIndex*SYSTEM_PAGE_SIZE, PageCount*SYSTEM_PAGE_SIZE, MADV_DONTNEED);
+}
 
-   void *RegionStartAddress = 0;
+// NOTE (MJP): Returns the number of pages written.
+function memory_index
+TakeArenaSnapshot(memory_arena *Arena, arena_snapshot *Snapshot)
+{
+   memory_index PageCount = ForEachDirtyRun(Arena, Snapshot, WriteBackDirtyRun);
+   Snapshot->Used = Arena->Used;
+   return(PageCount);
+}
 
-   chunk_region *AllocatedRegion = 0;
-   for (chunk_region *FreeRegion = ChunkAllocator->FreeRegionsSentinel->Next;
-                      FreeRegion != ChunkAllocator->FreeRegionsSentinel;
-                      FreeRegion = FreeRegion->Next)
+// NOTE (MJP): Puts the arena back to the last snapshot (or to empty if none
+// was taken). Returns the number of pages dropped.
+function memory_index
+RestoreArenaSnapshot(memory_arena *Arena, arena_snapshot *Snapshot)
+{
+   Assert(Arena->TempCount == 0);
+   memory_index PageCount = ForEachDirtyRun(Arena, Snapshot, DropDirtyRun);
+   Arena->Used = Snapshot->Used;
+   return(PageCount);
+}
+#endif
+
+// NOTE (MJP): Per thread scratch arenas, reserved on first use. A function
+// that pushes results onto an arena passed in by its caller has to pass that
+// arena as a conflict, so its scratch never aliases the caller's.
+//
+//    temporary_memory Scratch = GetScratch(OutArena);
+//    ...PushArray(Scratch.Arena, ...)...
+//    ReleaseScratch(Scratch);
+//
+// Threads should call ReleaseThreadScratchArenas before exiting, the arenas
+// aren't unmapped otherwise.
+
+#define SCRATCH_ARENA_COUNT 2
+#define SCRATCH_ARENA_RESERVE_SIZE GiB(1)
+
+global_variable thread_local memory_arena ScratchArenas[SCRATCH_ARENA_COUNT];
+
+function temporary_memory
+GetScratch(memory_arena **Conflicts, u32 ConflictCount)
+{
+   memory_arena *Scratch = 0;
+   for (u32 ArenaIndex = 0; ArenaIndex < SCRATCH_ARENA_COUNT; ++ArenaIndex)
    {
-      if (ChunkCount <= FreeRegion->Count)
+      memory_arena *Candidate = ScratchArenas + ArenaIndex;
+      b32 HasConflict = false;
+      for (u32 ConflictIndex = 0; ConflictIndex < ConflictCount; ++ConflictIndex)
       {
-         SDLLRemove(FreeRegion);
-         AllocatedRegion = FreeRegion;
-         InsertRegionInOrder(ChunkAllocator->AllocatedRegionsSentinel, AllocatedRegion);
-
-         u32 RemainingChunks = AllocatedRegion->Count - ChunkCount;
-         if (RemainingChunks)
+         if (Conflicts[ConflictIndex] == Candidate)
          {
-            u32 NewFreeRegionStartIndex = 
-                  (AllocatedRegion->StartIndex + ChunkCount);
-            chunk_region *NewFreeRegion =
-               NewChunkRegion(ChunkAllocator, NewFreeRegionStartIndex, RemainingChunks);
-            Assert(NewFreeRegion->StartIndex != AllocatedRegion->StartIndex);
-            InsertRegionInOrder(ChunkAllocator->FreeRegionsSentinel, NewFreeRegion);
-            // MergeNeighboringFreeRegions(ChunkAllocator);
+            HasConflict = true;
+            break;
          }
+      }
 
-         AllocatedRegion->Count = ChunkCount;
+      if (!HasConflict)
+      {
+         Scratch = Candidate;
          break;
       }
    }
-   Assert(AllocatedRegion);
+   AssertPrint(Scratch, "GetScratch: every scratch arena conflicts");
 
-   return(AllocatedRegion);
+   temporary_memory Result = {};
+   if (Scratch)
+   {
+      if (!Scratch->Base)
+      {
+         ArenaAlloc(Scratch, SCRATCH_ARENA_RESERVE_SIZE);
+      }
+      Result = BeginTemporaryMemory(Scratch);
+   }
+   return(Result);
 }
 
-#if 0
-// NOTE (mjp): Return an index to be used for relative pointers
-// TODO (MJP): For relative allocator to work we need to make the chunk_allocator linked lists be relative too
-function u32
-ResizeAllocationIndex(chunk_allocator *ChunkAllocator, u32 RegionStartIndex, u32 SizeBytes)
+inline temporary_memory
+GetScratch(memory_arena *Conflict = 0)
 {
-   chunk_region *SourceRegion =
-      GetAllocatedRegion(ChunkAllocator, RegionStartIndex);
+   temporary_memory Result = GetScratch(&Conflict, Conflict ? 1 : 0);
+   return(Result);
+}
 
-   chunk_region *NewRegion =
-      ResizeAllocation(ChunkAllocator, SourceRegion, SizeBytes);
+inline void
+ReleaseScratch(temporary_memory Scratch)
+{
+   EndTemporaryMemory(Scratch);
+}
 
-   return(NewRegion->StartIndex);
+function void
+ReleaseThreadScratchArenas()
+{
+   for (u32 ArenaIndex = 0; ArenaIndex < SCRATCH_ARENA_COUNT; ++ArenaIndex)
+   {
+      CheckArena(ScratchArenas + ArenaIndex);
+      ArenaRelease(ScratchArenas + ArenaIndex);
+   }
 }
 
-function void *
-ResizeAllocationVoid(chunk_allocator *ChunkAllocator, void *RegionStartAddress, u32 SizeBytes)
+// NOTE (MJP): Fixed size node pool on top of an arena. The pool's free list
+// is refilled a slab of SlabNodeCount nodes at a time, each slab starting on
+// a cache line, so consecutive allocations are adjacent in memory. PoolAlloc
+// is meant to be the alloc expression of the linked list macros:
+//
+//    SLLStackAlloc(Node, FreeNodes, PoolAlloc(&NodePool, node));
+//    SDLLAlloc(Node, &FreeSentinel, PoolAlloc(&NodePool, node));
+//
+// Nodes can go back to the list's own free list as before, or to the pool
+// with PoolFree. Memory only goes back to the OS with the arena.
+
+#define POOL_SLAB_NODE_COUNT 64
+
+struct memory_pool_node
 {
-   chunk_region *SourceRegion =
-      GetAllocatedRegion(ChunkAllocator, RegionStartAddress);
+   memory_pool_node *Next;
+};
 
-   chunk_region *NewRegion =
-      ResizeAllocation(ChunkAllocator, SourceRegion, SizeBytes);
+struct memory_pool
+{
+   memory_arena *Arena;
+   memory_index NodeSize;
+   memory_index NodeAlignment;
+   u32 SlabNodeCount;
+   memory_pool_node *FreeList;
+};
 
-   void *NewRegionStartAddress =
-      GetMemoryAddress(ChunkAllocator, NewRegion);
+function void
+InitializePool(memory_pool *Pool, memory_arena *Arena, memory_index NodeSize,
+               memory_index NodeAlignment = ARENA_DEFAULT_ALIGNMENT,
+               u32 SlabNodeCount = POOL_SLAB_NODE_COUNT)
+{
+   Assert(NodeAlignment && !(NodeAlignment & (NodeAlignment - 1)));
+   Assert(NodeAlignment <= L2_CACHE_SIZE);
+   Assert(SlabNodeCount);
 
-   return(NewRegionStartAddress);
+   ZeroStruct(*Pool);
+   Pool->Arena = Arena;
+   // NOTE (MJP): Free nodes hold the free list link.
+   Pool->NodeSize = AlignPow2(Max(NodeSize, SizeOf(memory_pool_node)), NodeAlignment);
+   Pool->NodeAlignment = NodeAlignment;
+   Pool->SlabNodeCount = SlabNodeCount;
 }
-#endif
 
+#define InitializePoolFor(Pool, Arena, Type, ...) InitializePool((Pool), (Arena), SizeOf(Type), ## __VA_ARGS__)
+
+// NOTE (MJP): Nodes are linked in address order, so a fresh slab is handed
+// out front to back.
+function void
+RefillPool(memory_pool *Pool)
+{
+   u8 *Slab = (u8 *)PushSize_(Pool->Arena, Pool->NodeSize*Pool->SlabNodeCount, L2_CACHE_SIZE);
+   if (Slab)
+   {
+      u8 *Node = Slab + Pool->NodeSize*(Pool->SlabNodeCount - 1);
+      for (u32 NodeIndex = 0; NodeIndex < Pool->SlabNodeCount; ++NodeIndex)
+      {
+         memory_pool_node *PoolNode = (memory_pool_node *)Node;
+         SLLStackPush(Pool->FreeList, PoolNode);
+         Node -= Pool->NodeSize;
+      }
+   }
+}
 
 function void *
-ResizeAllocationVoid(chunk_allocator *ChunkAllocator, void *RegionStartAddress, u32 SizeBytes)
+PoolAllocSize(memory_pool *Pool)
 {
-   chunk_region *SourceRegion =
-      GetAllocatedRegion(ChunkAllocator, RegionStartAddress);
+   if (!Pool->FreeList)
+   {
+      RefillPool(Pool);
+   }
 
-   Assert(ChunkAllocator->ChunkMemory);
-   void *NewRegionStartAddress = 0x0;
-   u32 NewChunkCount = GetChunkCount(SizeBytes);
+   memory_pool_node *Node = Pool->FreeList;
+   if (Node)
+   {
+      SLLStackPop(Pool->FreeList);
+   }
+   return(Node);
+}
 
-   if (NewChunkCount)
+inline void
+PoolFree(memory_pool *Pool, void *Node)
+{
+   if (Node)
    {
-      // TODO (MJP): Check neighboring regions and if free, and have enough
-      // space, expand the region to avoid copying
+      memory_pool_node *PoolNode = (memory_pool_node *)Node;
+      SLLStackPush(Pool->FreeList, PoolNode);
+   }
+}
 
-      chunk_region *DestRegion =
-         AllocateChunkRegion(ChunkAllocator, NewChunkCount);
+#define PoolAlloc(Pool, Type) ((Type *)PoolAllocSize(Pool))
 
-      if (SourceRegion)
-      {
-         // Copy and free
-         void *SourceMemory =
-            GetMemoryAddress(ChunkAllocator, SourceRegion);
-         void *DestMemory =
-            GetMemoryAddress(ChunkAllocator, DestRegion);
 
-         u32 CopySizeBytes =
-            GetSizeBytes(Min(SourceRegion->Count, DestRegion->Count));
-         u32 DestSizeBytes = GetSizeBytes(DestRegion->Count);
-         Assert(CopySizeBytes <= DestSizeBytes);
-         MemCopy(DestMemory, SourceMemory, CopySizeBytes);
 
-         // Move region to free regions
-         SDLLRemove(SourceRegion);
-         InsertRegionInOrder(ChunkAllocator->FreeRegionsSentinel, SourceRegion);
+// 
+// SECTION: BATCHED COPIES
+// 
+//
+
+// NOTE (MJP): For callers issuing lots of small copies at once, e.g. the mixer
+// copying voice buffers into bus slots. The ops are sorted by source cache
+// line (an LSD radix sort over only the key bits that differ, on a scratch
+// arena) so reads walk memory forwards, then run through the inlined MemMove
+// with the ops COPY_BATCH_PREFETCH_DISTANCE ahead prefetched. Sorting
+// reorders the ops, so with Sort set no op may read what another op writes.
+// It only pays off for bigger copies out of a cache sized source pool, for
+// a few hundred bytes or less per op it costs more than the copies do, so it
+// is off by default.
+
+#define COPY_BATCH_PREFETCH_DISTANCE 8
+// NOTE (MJP): Below this the sort costs more than it saves.
+#define COPY_BATCH_SORT_MIN 64
+
+struct copy_op
+{
+   void *Dest;
+   void *Source;
+   memory_index Size;
+};
+
+inline umm
+GetCopyOpKey(copy_op *Op)
+{
+   umm Result = (umm)Op->Source >> 6;
+   return(Result);
+}
 
-         Assert(GetMemoryAddress(ChunkAllocator, DestRegion) == DestMemory);
-      }
+function void
+SortCopyOps(copy_op *Ops, u32 Count)
+{
+   if (Count < 2)
+   {
+      return;
+   }
 
-      NewRegionStartAddress = GetMemoryAddress(ChunkAllocator, DestRegion);
+   umm FirstKey = GetCopyOpKey(Ops);
+   umm PrevKey = FirstKey;
+   umm DifferingBits = 0;
+   b32 IsSorted = true;
+   for (u32 OpIndex = 1; OpIndex < Count; ++OpIndex)
+   {
+      umm Key = GetCopyOpKey(Ops + OpIndex);
+      DifferingBits |= Key ^ FirstKey;
+      IsSorted = IsSorted && (Key >= PrevKey);
+      PrevKey = Key;
    }
-   else
+
+   if (!IsSorted)
    {
-      if (SourceRegion)
+      temporary_memory Scratch = GetScratch();
+      copy_op *From = Ops;
+      // NOTE (MJP): Sorting is only an optimization, without scratch space
+      // the ops just run in the order given.
+      copy_op *To = Scratch.Arena ? PushArray(Scratch.Arena, copy_op, Count) : 0;
+      for (u32 Shift = 0; To && (Shift < 64) && ((DifferingBits >> Shift) != 0); Shift += 8)
+      {
+         if (((DifferingBits >> Shift) & 0xFF) == 0)
+         {
+            continue;
+         }
+
+         u32 Offsets[256] = {};
+         for (u32 OpIndex = 0; OpIndex < Count; ++OpIndex)
+         {
+            ++Offsets[(GetCopyOpKey(From + OpIndex) >> Shift) & 0xFF];
+         }
+         u32 Total = 0;
+         for (u32 Digit = 0; Digit < 256; ++Digit)
+         {
+            u32 DigitCount = Offsets[Digit];
+            Offsets[Digit] = Total;
+            Total += DigitCount;
+         }
+         for (u32 OpIndex = 0; OpIndex < Count; ++OpIndex)
+         {
+            To[Offsets[(GetCopyOpKey(From + OpIndex) >> Shift) & 0xFF]++] = From[OpIndex];
+         }
+
+         copy_op *Swap = From;
+         From = To;
+         To = Swap;
+      }
+
+      if (From != Ops)
       {
-         SDLLRemove(SourceRegion);
-         InsertRegionInOrder(ChunkAllocator->FreeRegionsSentinel, SourceRegion);
+         MemCopy(Ops, From, SizeOf(copy_op)*Count);
       }
-      NewRegionStartAddress = 0x0;
+      if (Scratch.Arena)
+      {
+         ReleaseScratch(Scratch);
+      }
+   }
+}
+
+function void
+MemCopyBatch(copy_op *Ops, u32 Count, b32 Sort = false)
+{
+   if (Sort && (Count >= COPY_BATCH_SORT_MIN))
+   {
+      SortCopyOps(Ops, Count);
    }
 
-   MergeNeighboringFreeRegions(ChunkAllocator);
+   for (u32 OpIndex = 0; OpIndex < Count; ++OpIndex)
+   {
+      if ((OpIndex + COPY_BATCH_PREFETCH_DISTANCE) < Count)
+      {
+         copy_op *Ahead = Ops + OpIndex + COPY_BATCH_PREFETCH_DISTANCE;
+         __builtin_prefetch(Ahead->Source, 0);
+         __builtin_prefetch(Ahead->Dest, 1);
+      }
 
-   // CheckForClashingRegions(ChunkAllocator);
-   return(NewRegionStartAddress);
+      copy_op *Op = Ops + OpIndex;
+      MemMove(Op->Dest, Op->Source, Op->Size);
+   }
 }
 
-#define NULL_ALLOCATION 0x0
-// NOTE (MJP): User facing API
-#define NewAllocation(Allocator, Type, Count) (Type *)ResizeAllocationVoid(Allocator, (void *)NULL_ALLOCATION, SizeOf(Type)*Count)
-#define ResizeAllocation(Allocator, Allocation, Type, Count) (Type *)ResizeAllocationVoid((Allocator), (void *)(Allocation), SizeOf(Type)*(Count))
 
-#define FreeAllocation(Allocator, Allocation)
 
-#endif
+// 
+// SECTION: STRINGS
+// 
+//
+
+
+
+
+inline u8
+CharToLower(u8 Char)
+{
+   u8 Result = ((Char >= 'A') && (Char <= 'Z')) ? (u8)(Char + ('a' - 'A')) : Char;
+   return(Result);
+}
+
+inline u8
+CharToUpper(u8 Char)
+{
+   u8 Result = ((Char >= 'a') && (Char <= 'z')) ? (u8)(Char - ('a' - 'A')) : Char;
+   return(Result);
+}
+
+inline b32
+CharIsSpace(u8 Char)
+{
+   b32 Result = ((Char == ' ') || (Char == '\t') || (Char == '\n') ||
+                 (Char == '\r') || (Char == '\f') || (Char == '\v'));
+   return(Result);
+}
+
+// NOTE (MJP): SIMD scanning primitives, 32 bytes at a time with AVX2, 16 with
+// SSE2, and plain loops (or libc) without MJP__USE_SSE. Scans of a single
+// string only do aligned loads, masking off the bytes before the start and
+// past the end, so they never touch a page the string doesn't, and
+// CStringLength can run ahead of the terminator safely. (Address sanitizers
+// will still flag the over-read within the page.) Comparisons of two strings
+// only load inside both strings, with an overlapping last vector.
+#if MJP__USE_SSE && defined(__AVX2__)
+#define SCAN_VECTOR_SIZE 32
+typedef __m256i scan_vector;
+#define ScanLoad_(Ptr) _mm256_load_si256((__m256i *)(Ptr))
+#define ScanLoadUnaligned_(Ptr) _mm256_loadu_si256((__m256i *)(Ptr))
+#define ScanSet1_(Byte) _mm256_set1_epi8((char)(Byte))
+#define ScanEqual_(A, B) _mm256_cmpeq_epi8((A), (B))
+#define ScanGreater_(A, B) _mm256_cmpgt_epi8((A), (B))
+#define ScanOr_(A, B) _mm256_or_si256((A), (B))
+#define ScanAnd_(A, B) _mm256_and_si256((A), (B))
+#define ScanAdd_(A, B) _mm256_add_epi8((A), (B))
+#define ScanMask_(Vector) (u32)_mm256_movemask_epi8(Vector)
+#elif MJP__USE_SSE
+#define SCAN_VECTOR_SIZE 16
+typedef __m128i scan_vector;
+#define ScanLoad_(Ptr) _mm_load_si128((__m128i *)(Ptr))
+#define ScanLoadUnaligned_(Ptr) _mm_loadu_si128((__m128i *)(Ptr))
+#define ScanSet1_(Byte) _mm_set1_epi8((char)(Byte))
+#define ScanEqual_(A, B) _mm_cmpeq_epi8((A), (B))
+#define ScanGreater_(A, B) _mm_cmpgt_epi8((A), (B))
+#define ScanOr_(A, B) _mm_or_si128((A), (B))
+#define ScanAnd_(A, B) _mm_and_si128((A), (B))
+#define ScanAdd_(A, B) _mm_add_epi8((A), (B))
+#define ScanMask_(Vector) (u32)_mm_movemask_epi8(Vector)
+#endif
+
+// NOTE (MJP): Sets with more bytes than this are looked up in a 256 bit
+// table a byte at a time instead.
+#define SCAN_SET_MAX 8
+
+#if MJP__USE_SSE
+inline u8 *
+GetScanBlock_(u8 *Ptr)
+{
+   u8 *Result = (u8 *)((umm)Ptr & ~(umm)(SCAN_VECTOR_SIZE - 1));
+   return(Result);
+}
+
+// NOTE (MJP): Mask of the block's bytes at or after Ptr.
+inline u32
+GetScanHeadMask_(u8 *Block, u8 *Ptr)
+{
+   u32 Result = 0xFFFFFFFF << (u32)(Ptr - Block);
+   return(Result);
+}
+
+// NOTE (MJP): 'A'-'Z' are the bytes that, offset so 'A' lands on -128,
+// compare below -128 + 26. Those get 0x20 added.
+inline scan_vector
+ScanToLower_(scan_vector Bytes)
+{
+   scan_vector Shifted = ScanAdd_(Bytes, ScanSet1_(128 - 'A'));
+   scan_vector IsUpper = ScanGreater_(ScanSet1_(-128 + 26), Shifted);
+   scan_vector Result = ScanAdd_(Bytes, ScanAnd_(IsUpper, ScanSet1_(0x20)));
+   return(Result);
+}
+#endif
+
+#if MJP__USE_SSE
+// NOTE (MJP): Shared loop of the single string scans. Returns the first
+// matching byte at or after Str, or something >= End when there is none in
+// [Str, End). After the first block it steps to a two vector boundary and
+// then checks two vectors (a cache line with AVX2) per iteration, so each
+// pair of loads stays on one page.
+inline scan_vector
+ScanMatchAnyOf_(scan_vector Bytes, scan_vector *Needles, u32 NeedleCount)
+{
+   scan_vector Result = ScanEqual_(Bytes, Needles[0]);
+   for (u32 NeedleIndex = 1; NeedleIndex < NeedleCount; ++NeedleIndex)
+   {
+      Result = ScanOr_(Result, ScanEqual_(Bytes, Needles[NeedleIndex]));
+   }
+   return(Result);
+}
+
+inline u8 *
+ScanForAnyOf_(u8 *Str, u8 *End, scan_vector *Needles, u32 NeedleCount)
+{
+   u8 *Block = GetScanBlock_(Str);
+   u64 Mask = ScanMask_(ScanMatchAnyOf_(ScanLoad_(Block), Needles, NeedleCount)) &
+      GetScanHeadMask_(Block, Str);
+   u8 *Next = Block + SCAN_VECTOR_SIZE;
+   if (!Mask && ((umm)Next & SCAN_VECTOR_SIZE) && (Next < End))
+   {
+      Block = Next;
+      Mask = ScanMask_(ScanMatchAnyOf_(ScanLoad_(Block), Needles, NeedleCount));
+      Next += SCAN_VECTOR_SIZE;
+   }
+   while (!Mask && (Next < End))
+   {
+      Block = Next;
+      u64 MaskA = ScanMask_(ScanMatchAnyOf_(ScanLoad_(Block), Needles, NeedleCount));
+      u64 MaskB = ScanMask_(ScanMatchAnyOf_(ScanLoad_(Block + SCAN_VECTOR_SIZE), Needles, NeedleCount));
+      Mask = MaskA | (MaskB << SCAN_VECTOR_SIZE);
+      Next += 2*SCAN_VECTOR_SIZE;
+   }
+
+   u8 *Result = Mask ? (Block + FindLeastSignificantSetBit(Mask).Index) : End;
+   return(Result);
+}
+#endif
+
+inline u64
+CStringLength(char *String)
+{
+#if MJP__USE_SSE
+   scan_vector Zero = ScanSet1_(0);
+   u8 *End = (u8 *)~(umm)0;
+   u64 Result = (u64)(ScanForAnyOf_((u8 *)String, End, &Zero, 1) - (u8 *)String);
+#else
+   u64 Result = strlen(String);
+#endif
+   return(Result);
+}
+
+// NOTE (MJP): Index of the first Byte in [0, Size), or Size.
+function u64
+ScanForByte(u8 *Str, u64 Size, u8 Byte)
+{
+   u64 Result = Size;
+   if (Size)
+   {
+#if MJP__USE_SSE
+      scan_vector Needle = ScanSet1_(Byte);
+      Result = Min((u64)(ScanForAnyOf_(Str, Str + Size, &Needle, 1) - Str), Size);
+#else
+      u8 *Found = (u8 *)memchr(Str, Byte, Size);
+      if (Found)
+      {
+         Result = (u64)(Found - Str);
+      }
+#endif
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Index of the first byte in [0, Size) that is in Set, or Size.
+function u64
+ScanForAnyOf(u8 *Str, u64 Size, u8 *Set, u32 SetCount)
+{
+   u64 Result = Size;
+   if (!Size || !SetCount)
+   {
+      return(Result);
+   }
+
+#if MJP__USE_SSE
+   if (SetCount <= SCAN_SET_MAX)
+   {
+      // NOTE (MJP): The set is padded (repeating its first byte) to 2, 4 or
+      // 8 needles so each call below gets a constant count to unroll.
+      scan_vector Needles[SCAN_SET_MAX];
+      u32 NeedleCount = (SetCount <= 2) ? 2 : ((SetCount <= 4) ? 4 : 8);
+      for (u32 NeedleIndex = 0; NeedleIndex < NeedleCount; ++NeedleIndex)
+      {
+         Needles[NeedleIndex] = ScanSet1_(Set[(NeedleIndex < SetCount) ? NeedleIndex : 0]);
+      }
+
+      u8 *End = Str + Size;
+      u8 *Found = End;
+      switch (NeedleCount)
+      {
+         case 2: Found = ScanForAnyOf_(Str, End, Needles, 2); break;
+         case 4: Found = ScanForAnyOf_(Str, End, Needles, 4); break;
+         default: Found = ScanForAnyOf_(Str, End, Needles, 8); break;
+      }
+      Result = Min((u64)(Found - Str), Size);
+      return(Result);
+   }
+#endif
+
+   u32 Table[8] = {};
+   for (u32 SetIndex = 0; SetIndex < SetCount; ++SetIndex)
+   {
+      Table[Set[SetIndex] >> 5] |= (1u << (Set[SetIndex] & 31));
+   }
+   for (u64 Index = 0; Index < Size; ++Index)
+   {
+      if (Table[Str[Index] >> 5] & (1u << (Str[Index] & 31)))
+      {
+         Result = Index;
+         break;
+      }
+   }
+   return(Result);
+}
+
+#if MJP__USE_SSE
+inline u32
+ScanDifferenceMask_(u8 *A, u8 *B, b32 IgnoreCase)
+{
+   scan_vector VectorA = ScanLoadUnaligned_(A);
+   scan_vector VectorB = ScanLoadUnaligned_(B);
+   if (IgnoreCase)
+   {
+      VectorA = ScanToLower_(VectorA);
+      VectorB = ScanToLower_(VectorB);
+   }
+   u32 Result = ~ScanMask_(ScanEqual_(VectorA, VectorB)) & (u32)((1ull << SCAN_VECTOR_SIZE) - 1);
+   return(Result);
+}
+
+// NOTE (MJP): Size must be >= SCAN_VECTOR_SIZE. Called with a constant
+// IgnoreCase so the check is hoisted out of the loop.
+inline u64
+ScanForDifference_(u8 *A, u8 *B, u64 Size, b32 IgnoreCase)
+{
+   u64 Index = 0;
+   while ((Size - Index) >= 2*SCAN_VECTOR_SIZE)
+   {
+      u64 Mask = ((u64)ScanDifferenceMask_(A + Index, B + Index, IgnoreCase) |
+                  ((u64)ScanDifferenceMask_(A + Index + SCAN_VECTOR_SIZE,
+                                            B + Index + SCAN_VECTOR_SIZE, IgnoreCase) << SCAN_VECTOR_SIZE));
+      if (Mask)
+      {
+         return(Index + FindLeastSignificantSetBit(Mask).Index);
+      }
+      Index += 2*SCAN_VECTOR_SIZE;
+   }
+
+   // NOTE (MJP): At most two more vectors, the last overlapping bytes
+   // already compared.
+   u64 Result = Size;
+   if (Index < Size)
+   {
+      if ((Size - Index) > SCAN_VECTOR_SIZE)
+      {
+         u32 Mask = ScanDifferenceMask_(A + Index, B + Index, IgnoreCase);
+         if (Mask)
+         {
+            return(Index + FindLeastSignificantSetBit(Mask).Index);
+         }
+      }
+
+      Index = Size - SCAN_VECTOR_SIZE;
+      u32 Mask = ScanDifferenceMask_(A + Index, B + Index, IgnoreCase);
+      if (Mask)
+      {
+         Result = Index + FindLeastSignificantSetBit(Mask).Index;
+      }
+   }
+   return(Result);
+}
+#endif
+
+// NOTE (MJP): Index of the first byte in [0, Size) where A and B differ, or
+// Size. With IgnoreCase, ASCII letters compare equal to their other case.
+function u64
+ScanForDifference(u8 *A, u8 *B, u64 Size, b32 IgnoreCase = false)
+{
+   u64 Index = 0;
+#if MJP__USE_SSE
+   if (Size >= SCAN_VECTOR_SIZE)
+   {
+      u64 Result = IgnoreCase ? ScanForDifference_(A, B, Size, true) : ScanForDifference_(A, B, Size, false);
+      return(Result);
+   }
+#endif
+   if (!IgnoreCase)
+   {
+      // NOTE (MJP): A word at a time, the lowest set bit of the xor is the
+      // first differing byte on little endian.
+      for (; (Size - Index) >= 8; Index += 8)
+      {
+         u64 WordA, WordB;
+         memcpy(&WordA, A + Index, 8);
+         memcpy(&WordB, B + Index, 8);
+         if (WordA != WordB)
+         {
+            return(Index + (FindLeastSignificantSetBit(WordA ^ WordB).Index >> 3));
+         }
+      }
+   }
+
+   u64 Result = Size;
+   for (; Index < Size; ++Index)
+   {
+      b32 Differs = IgnoreCase ? (CharToLower(A[Index]) != CharToLower(B[Index])) : (A[Index] != B[Index]);
+      if (Differs)
+      {
+         Result = Index;
+         break;
+      }
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Pointer + length strings. Nothing here depends on a null
+// terminator, so slicing is free and nothing is ever rescanned for the end.
+// Strings pushed onto an arena do get a terminator (not counted in Size) so
+// they can still be handed to C APIs.
+struct string8
+{
+   u8 *Str;
+   u64 Size;
+};
+
+#define Str8Lit(Literal) Str8((u8 *)(Literal), SizeOf(Literal) - 1)
+#define Str8Expand(String) (int)((String).Size), (char *)((String).Str)
+
+enum string8_match_flags
+{
+   STR8_MATCH_CASE_INSENSITIVE = (1 << 0),
+   // NOTE (MJP): B may be longer than A, only A's length is compared.
+   STR8_MATCH_RIGHT_SIDE_SLOPPY = (1 << 1),
+};
+
+inline string8
+Str8(u8 *Str, u64 Size)
+{
+   string8 Result = {Str, Size};
+   return(Result);
+}
+
+inline string8
+Str8Range(u8 *First, u8 *OnePastLast)
+{
+   string8 Result = {First, (u64)(OnePastLast - First)};
+   return(Result);
+}
+
+inline string8
+Str8C(char *CString)
+{
+   string8 Result = {(u8 *)CString, CString ? CStringLength(CString) : 0};
+   return(Result);
+}
+
+inline string8
+Substr8(string8 String, u64 First, u64 OnePastLast)
+{
+   OnePastLast = Min(OnePastLast, String.Size);
+   First = Min(First, OnePastLast);
+   string8 Result = {String.Str + First, OnePastLast - First};
+   return(Result);
+}
+
+inline string8
+Str8Prefix(string8 String, u64 Size)
+{
+   string8 Result = Substr8(String, 0, Size);
+   return(Result);
+}
+
+inline string8
+Str8Postfix(string8 String, u64 Size)
+{
+   Size = Min(Size, String.Size);
+   string8 Result = Substr8(String, String.Size - Size, String.Size);
+   return(Result);
+}
+
+inline string8
+Str8Skip(string8 String, u64 Count)
+{
+   string8 Result = Substr8(String, Count, String.Size);
+   return(Result);
+}
+
+inline string8
+Str8Chop(string8 String, u64 Count)
+{
+   Count = Min(Count, String.Size);
+   string8 Result = Substr8(String, 0, String.Size - Count);
+   return(Result);
+}
+
+function b32
+Str8Match(string8 A, string8 B, u32 Flags = 0)
+{
+   if (Flags & STR8_MATCH_RIGHT_SIDE_SLOPPY)
+   {
+      B = Str8Prefix(B, A.Size);
+   }
+
+   b32 Result = (A.Size == B.Size);
+   if (Result && A.Size)
+   {
+      Result = (Flags & STR8_MATCH_CASE_INSENSITIVE) ?
+         (ScanForDifference(A.Str, B.Str, A.Size, true) == A.Size) :
+         (memcmp(A.Str, B.Str, A.Size) == 0);
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Lexicographic, shorter strings first on a shared prefix.
+// Returns < 0, 0 or > 0 like strcmp. Only STR8_MATCH_CASE_INSENSITIVE is
+// used from Flags, letters then compare as lower case.
+function s32
+Str8Compare(string8 A, string8 B, u32 Flags = 0)
+{
+   b32 IgnoreCase = Flags & STR8_MATCH_CASE_INSENSITIVE;
+   u64 Size = Min(A.Size, B.Size);
+   u64 Index = ScanForDifference(A.Str, B.Str, Size, IgnoreCase);
+   s32 Result = 0;
+   if (Index < Size)
+   {
+      u8 CharA = IgnoreCase ? CharToLower(A.Str[Index]) : A.Str[Index];
+      u8 CharB = IgnoreCase ? CharToLower(B.Str[Index]) : B.Str[Index];
+      Result = (CharA < CharB) ? -1 : 1;
+   }
+   else
+   {
+      Result = (A.Size < B.Size) ? -1 : ((A.Size > B.Size) ? 1 : 0);
+   }
+   return(Result);
+}
+
+inline b32
+Str8StartsWith(string8 String, string8 Prefix, u32 Flags = 0)
+{
+   b32 Result = Str8Match(Prefix, String, Flags | STR8_MATCH_RIGHT_SIDE_SLOPPY);
+   return(Result);
+}
+
+inline b32
+Str8EndsWith(string8 String, string8 Postfix, u32 Flags = 0)
+{
+   b32 Result = Str8Match(Postfix, Str8Postfix(String, Postfix.Size), Flags);
+   return(Result);
+}
+
+// NOTE (MJP): Returns the index of the first match at or after StartIndex, or
+// Haystack.Size when there is none.
+function u64
+FindSubstr8(string8 Haystack, string8 Needle, u64 StartIndex = 0, u32 Flags = 0)
+{
+   u64 Result = Haystack.Size;
+   if ((Needle.Size <= Haystack.Size) && (StartIndex <= (Haystack.Size - Needle.Size)))
+   {
+      u64 LastStart = Haystack.Size - Needle.Size;
+      if (Needle.Size == 0)
+      {
+         Result = StartIndex;
+      }
+      else
+      {
+         // NOTE (MJP): Scan for the first byte (in either case), then compare
+         // the rest.
+         b32 IgnoreCase = Flags & STR8_MATCH_CASE_INSENSITIVE;
+         u8 First[2] = {CharToLower(Needle.Str[0]), CharToUpper(Needle.Str[0])};
+         if (!IgnoreCase)
+         {
+            First[0] = First[1] = Needle.Str[0];
+         }
+
+         u64 Index = StartIndex;
+         while (Index <= LastStart)
+         {
+            u64 SearchSize = LastStart - Index + 1;
+            u64 Found = (First[0] == First[1]) ?
+               ScanForByte(Haystack.Str + Index, SearchSize, First[0]) :
+               ScanForAnyOf(Haystack.Str + Index, SearchSize, First, 2);
+            if (Found == SearchSize)
+            {
+               break;
+            }
+
+            Index += Found;
+            if (ScanForDifference(Haystack.Str + Index + 1, Needle.Str + 1,
+                                  Needle.Size - 1, IgnoreCase) == (Needle.Size - 1))
+            {
+               Result = Index;
+               break;
+            }
+            ++Index;
+         }
+      }
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Returns String.Size when Byte isn't found.
+inline u64
+FindByte8(string8 String, u8 Byte, u64 StartIndex = 0)
+{
+   u64 Result = String.Size;
+   if (StartIndex < String.Size)
+   {
+      Result = StartIndex + ScanForByte(String.Str + StartIndex, String.Size - StartIndex, Byte);
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Returns String.Size when no byte of Set is found.
+inline u64
+FindAnyOf8(string8 String, string8 Set, u64 StartIndex = 0)
+{
+   u64 Result = String.Size;
+   if (StartIndex < String.Size)
+   {
+      Result = StartIndex + ScanForAnyOf(String.Str + StartIndex, String.Size - StartIndex,
+                                         Set.Str, (u32)Set.Size);
+   }
+   return(Result);
+}
+
+inline b32
+Str8Contains(string8 Haystack, string8 Needle, u32 Flags = 0)
+{
+   b32 Result = (FindSubstr8(Haystack, Needle, 0, Flags) < Haystack.Size) || (Needle.Size == 0);
+   return(Result);
+}
+
+function string8
+Str8Trim(string8 String)
+{
+   u64 First = 0;
+   while ((First < String.Size) && CharIsSpace(String.Str[First]))
+   {
+      ++First;
+   }
+   u64 OnePastLast = String.Size;
+   while ((OnePastLast > First) && CharIsSpace(String.Str[OnePastLast - 1]))
+   {
+      --OnePastLast;
+   }
+   string8 Result = Substr8(String, First, OnePastLast);
+   return(Result);
+}
+
+// NOTE (MJP): Eight bytes per multiply, with the murmur3 finalizer at the
+// end. Not for anything adversarial.
+inline u64
+MixHash64(u64 Value)
+{
+   Value ^= Value >> 33;
+   Value *= 0xff51afd7ed558ccdull;
+   Value ^= Value >> 33;
+   Value *= 0xc4ceb9fe1a85ec53ull;
+   Value ^= Value >> 33;
+   return(Value);
+}
+
+function u64
+HashStr8(string8 String)
+{
+   u64 Result = 0x9e3779b97f4a7c15ull ^ (String.Size*0xc2b2ae3d27d4eb4full);
+   u64 Index = 0;
+   for (; (String.Size - Index) >= 8; Index += 8)
+   {
+      u64 Word;
+      memcpy(&Word, String.Str + Index, 8);
+      Result = (Result ^ Word)*0x9fb21c651e98df25ull;
+      Result ^= Result >> 29;
+   }
+   if (Index < String.Size)
+   {
+      u64 Word = 0;
+      memcpy(&Word, String.Str + Index, String.Size - Index);
+      Result = (Result ^ Word)*0x9fb21c651e98df25ull;
+   }
+   Result = MixHash64(Result);
+   return(Result);
+}
+
+function string8
+PushStr8Copy(memory_arena *Arena, string8 String)
+{
+   string8 Result = {};
+   u8 *Str = PushArray(Arena, u8, String.Size + 1, 1);
+   if (Str)
+   {
+      MemCopy(Str, String.Str, String.Size);
+      Str[String.Size] = 0;
+      Result = Str8(Str, String.Size);
+   }
+   return(Result);
+}
+
+function string8
+PushStr8Cat(memory_arena *Arena, string8 A, string8 B)
+{
+   string8 Result = {};
+   u8 *Str = PushArray(Arena, u8, A.Size + B.Size + 1, 1);
+   if (Str)
+   {
+      MemCopy(Str, A.Str, A.Size);
+      MemCopy(Str + A.Size, B.Str, B.Size);
+      Str[A.Size + B.Size] = 0;
+      Result = Str8(Str, A.Size + B.Size);
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Formats straight into the arena. The first vsnprintf goes into
+// whatever is left of the current commit, so the common case formats once;
+// only when that's too small is the exact size pushed and it formats again.
+function string8
+PushStr8FV(memory_arena *Arena, char *Format, va_list Args)
+{
+   string8 Result = {};
+   va_list ArgsCopy;
+   va_copy(ArgsCopy, Args);
+
+   memory_index Available = Arena->CommittedSize - Arena->Used;
+   u8 *Str = (u8 *)Arena->Base + Arena->Used;
+   int Size = vsnprintf((char *)Str, Available, Format, Args);
+   if (Size >= 0)
+   {
+      if ((memory_index)Size < Available)
+      {
+         PushArray(Arena, u8, Size + 1, 1);
+      }
+      else
+      {
+         Str = PushArray(Arena, u8, Size + 1, 1);
+         if (Str)
+         {
+            vsnprintf((char *)Str, Size + 1, Format, ArgsCopy);
+         }
+      }
+
+      if (Str)
+      {
+         Result = Str8(Str, (u64)Size);
+      }
+   }
+   va_end(ArgsCopy);
+   return(Result);
+}
+
+function string8
+PushStr8F(memory_arena *Arena, char *Format, ...)
+{
+   va_list Args;
+   va_start(Args, Format);
+   string8 Result = PushStr8FV(Arena, Format, Args);
+   va_end(Args);
+   return(Result);
+}
+
+inline char *
+Str8ToCString(memory_arena *Arena, string8 String)
+{
+   char *Result = (char *)PushStr8Copy(Arena, String).Str;
+   return(Result);
+}
+
+// NOTE (MJP): String lists for building strings piece by piece. Nodes live
+// on the arena and are linked with SLLQueuePush, TotalSize is kept up to
+// date, so Str8ListJoin makes one allocation of the exact size and copies
+// each piece once. Str8ListPush only references the piece, the caller keeps
+// it alive until the join; Str8ListPushCopy and Str8ListPushF put the bytes
+// on the arena as well.
+//
+//    string8_list List = {};
+//    Str8ListPush(Arena, &List, Str8Lit("Voices: "));
+//    Str8ListPushF(Arena, &List, "%d", VoiceCount);
+//    string8 Text = Str8ListJoin(Arena, &List);
+
+struct string8_node
+{
+   string8_node *Next;
+   string8 String;
+};
+
+struct string8_list
+{
+   string8_node *First;
+   string8_node *Last;
+   u64 NodeCount;
+   u64 TotalSize;
+};
+
+struct string8_join
+{
+   string8 Pre;
+   string8 Separator;
+   string8 Post;
+};
+
+inline void
+Str8ListPushNode(string8_list *List, string8_node *Node)
+{
+   SLLQueuePush(List->First, List->Last, Node);
+   ++List->NodeCount;
+   List->TotalSize += Node->String.Size;
+}
+
+inline void
+Str8ListPushNodeFront(string8_list *List, string8_node *Node)
+{
+   SLLQueuePushFront(List->First, List->Last, Node);
+   ++List->NodeCount;
+   List->TotalSize += Node->String.Size;
+}
+
+function string8_node *
+Str8ListPush(memory_arena *Arena, string8_list *List, string8 String)
+{
+   string8_node *Node = PushStruct(Arena, string8_node);
+   if (Node)
+   {
+      Node->String = String;
+      Str8ListPushNode(List, Node);
+   }
+   return(Node);
+}
+
+function string8_node *
+Str8ListPushFront(memory_arena *Arena, string8_list *List, string8 String)
+{
+   string8_node *Node = PushStruct(Arena, string8_node);
+   if (Node)
+   {
+      Node->String = String;
+      Str8ListPushNodeFront(List, Node);
+   }
+   return(Node);
+}
+
+inline string8_node *
+Str8ListPushCopy(memory_arena *Arena, string8_list *List, string8 String)
+{
+   string8_node *Result = Str8ListPush(Arena, List, PushStr8Copy(Arena, String));
+   return(Result);
+}
+
+function string8_node *
+Str8ListPushF(memory_arena *Arena, string8_list *List, char *Format, ...)
+{
+   va_list Args;
+   va_start(Args, Format);
+   string8 String = PushStr8FV(Arena, Format, Args);
+   va_end(Args);
+
+   string8_node *Result = Str8ListPush(Arena, List, String);
+   return(Result);
+}
+
+// NOTE (MJP): Moves all of ToPush's nodes onto the end of List, leaving
+// ToPush empty.
+function void
+Str8ListConcat(string8_list *List, string8_list *ToPush)
+{
+   if (ToPush->First)
+   {
+      if (List->Last)
+      {
+         List->Last->Next = ToPush->First;
+      }
+      else
+      {
+         List->First = ToPush->First;
+      }
+      List->Last = ToPush->Last;
+      List->NodeCount += ToPush->NodeCount;
+      List->TotalSize += ToPush->TotalSize;
+      ZeroStruct(*ToPush);
+   }
+}
+
+// NOTE (MJP): Splits on any byte of SplitChars, empty pieces are dropped. The
+// pieces point into String.
+function string8_list
+Str8Split(memory_arena *Arena, string8 String, string8 SplitChars)
+{
+   string8_list Result = {};
+   u64 First = 0;
+   while (First < String.Size)
+   {
+      u64 OnePastLast = FindAnyOf8(String, SplitChars, First);
+      if (OnePastLast > First)
+      {
+         Str8ListPush(Arena, &Result, Substr8(String, First, OnePastLast));
+      }
+      First = OnePastLast + 1;
+   }
+   return(Result);
+}
+
+function string8
+Str8ListJoin(memory_arena *Arena, string8_list *List, string8_join *Join = 0)
+{
+   string8_join NoJoin = {};
+   if (!Join)
+   {
+      Join = &NoJoin;
+   }
+
+   u64 SeparatorCount = List->NodeCount ? (List->NodeCount - 1) : 0;
+   u64 Size = (Join->Pre.Size + List->TotalSize +
+               Join->Separator.Size*SeparatorCount + Join->Post.Size);
+
+   string8 Result = {};
+   u8 *Str = PushArray(Arena, u8, Size + 1, 1);
+   if (Str)
+   {
+      u8 *At = Str;
+      MemCopy(At, Join->Pre.Str, Join->Pre.Size);
+      At += Join->Pre.Size;
+      for (string8_node *Node = List->First; Node; Node = Node->Next)
+      {
+         MemCopy(At, Node->String.Str, Node->String.Size);
+         At += Node->String.Size;
+         if (Node->Next)
+         {
+            MemCopy(At, Join->Separator.Str, Join->Separator.Size);
+            At += Join->Separator.Size;
+         }
+      }
+      MemCopy(At, Join->Post.Str, Join->Post.Size);
+      At += Join->Post.Size;
+      Assert((u64)(At - Str) == Size);
+
+      *At = 0;
+      Result = Str8(Str, Size);
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Interning table, mapping strings to stable u32 ids so name
+// equality is an integer compare. Ids start at 1, NULL_STRING_ID is never
+// handed out. Interned strings are copied onto the table's arena (null
+// terminated) and never move, so GetInternedStr8 results stay valid for the
+// life of the arena.
+//
+// Slots are open addressed with linear probing and hold the id plus 32 bits
+// of the hash, so a probe only touches the string on a hash match. The slot
+// table is kept at most half full, which keeps hits at about one probe.
+// Growing pushes new slot and string arrays onto the arena, the old ones are
+// left there (less than the new ones in total). Not thread safe.
+
+typedef u32 string_id;
+#define NULL_STRING_ID 0
+#define INTERN_TABLE_DEFAULT_SLOT_COUNT 256
+
+struct string_intern_slot
+{
+   u32 Hash;
+   string_id Id;
+};
+
+struct string_intern_table
+{
+   memory_arena *Arena;
+   string_intern_slot *Slots;
+   u32 SlotCount;
+   // NOTE (MJP): Strings[Id - 1].
+   string8 *Strings;
+   u32 StringCapacity;
+   u32 Count;
+};
+
+function b32
+InitializeInternTable(string_intern_table *Table, memory_arena *Arena,
+                      u32 SlotCount = INTERN_TABLE_DEFAULT_SLOT_COUNT)
+{
+   Assert(SlotCount && !(SlotCount & (SlotCount - 1)));
+
+   ZeroStruct(*Table);
+   Table->Arena = Arena;
+   Table->Slots = PushArrayZero(Arena, string_intern_slot, SlotCount);
+   Table->Strings = PushArray(Arena, string8, SlotCount/2);
+   if (Table->Slots && Table->Strings)
+   {
+      Table->SlotCount = SlotCount;
+      Table->StringCapacity = SlotCount/2;
+   }
+   b32 Result = (Table->SlotCount != 0);
+   return(Result);
+}
+
+inline u32
+GetInternSlotHash(u64 Hash)
+{
+   u32 Result = (u32)(Hash >> 32);
+   return(Result);
+}
+
+// NOTE (MJP): Returns the slot holding String, or the empty slot it would go
+// in.
+function string_intern_slot *
+FindInternSlot(string_intern_table *Table, string8 String, u64 Hash)
+{
+   u32 Mask = Table->SlotCount - 1;
+   u32 SlotHash = GetInternSlotHash(Hash);
+   u32 SlotIndex = (u32)Hash & Mask;
+   for (;;)
+   {
+      string_intern_slot *Slot = Table->Slots + SlotIndex;
+      if ((Slot->Id == NULL_STRING_ID) ||
+          ((Slot->Hash == SlotHash) && Str8Match(Table->Strings[Slot->Id - 1], String)))
+      {
+         return(Slot);
+      }
+      SlotIndex = (SlotIndex + 1) & Mask;
+   }
+}
+
+function b32
+GrowInternTable(string_intern_table *Table)
+{
+   u32 NewSlotCount = Table->SlotCount*2;
+   string_intern_slot *NewSlots = PushArrayZero(Table->Arena, string_intern_slot, NewSlotCount);
+   string8 *NewStrings = PushArray(Table->Arena, string8, NewSlotCount/2);
+   b32 Result = (NewSlots && NewStrings);
+   if (Result)
+   {
+      // NOTE (MJP): The low bits of the full hash aren't kept, so the strings
+      // are hashed again to place them.
+      u32 Mask = NewSlotCount - 1;
+      for (u32 SlotIndex = 0; SlotIndex < Table->SlotCount; ++SlotIndex)
+      {
+         string_intern_slot *Slot = Table->Slots + SlotIndex;
+         if (Slot->Id != NULL_STRING_ID)
+         {
+            u32 NewIndex = (u32)HashStr8(Table->Strings[Slot->Id - 1]) & Mask;
+            while (NewSlots[NewIndex].Id != NULL_STRING_ID)
+            {
+               NewIndex = (NewIndex + 1) & Mask;
+            }
+            NewSlots[NewIndex] = *Slot;
+         }
+      }
+      MemCopy(NewStrings, Table->Strings, SizeOf(string8)*Table->Count);
+
+      Table->Slots = NewSlots;
+      Table->SlotCount = NewSlotCount;
+      Table->Strings = NewStrings;
+      Table->StringCapacity = NewSlotCount/2;
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Returns NULL_STRING_ID if String isn't interned, or the table
+// was never set up.
+function string_id
+FindInternedStr8(string_intern_table *Table, string8 String)
+{
+   string_id Result = NULL_STRING_ID;
+   if (Table->SlotCount)
+   {
+      Result = FindInternSlot(Table, String, HashStr8(String))->Id;
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Returns NULL_STRING_ID only if the arena is out of space, or
+// the table was never set up (InitializeInternTable failed or wasn't called).
+function string_id
+InternStr8(string_intern_table *Table, string8 String)
+{
+   string_id Result = NULL_STRING_ID;
+   if (Table->SlotCount)
+   {
+      u64 Hash = HashStr8(String);
+      string_intern_slot *Slot = FindInternSlot(Table, String, Hash);
+      if (Slot->Id == NULL_STRING_ID)
+      {
+         b32 HasRoom = ((Table->Count + 1) <= Table->StringCapacity);
+         if (!HasRoom && GrowInternTable(Table))
+         {
+            HasRoom = true;
+            Slot = FindInternSlot(Table, String, Hash);
+         }
+
+         string8 Copy = {};
+         if (HasRoom)
+         {
+            Copy = PushStr8Copy(Table->Arena, String);
+         }
+         if (Copy.Str)
+         {
+            Table->Strings[Table->Count++] = Copy;
+            Slot->Hash = GetInternSlotHash(Hash);
+            Slot->Id = Table->Count;
+         }
+      }
+      Result = Slot->Id;
+   }
+   return(Result);
+}
+
+inline string8
+GetInternedStr8(string_intern_table *Table, string_id Id)
+{
+   string8 Result = {};
+   if ((Id != NULL_STRING_ID) && (Id <= Table->Count))
+   {
+      Result = Table->Strings[Id - 1];
+   }
+   return(Result);
+}
+
+inline int
+StringLength(char *String)
+{
+   int Result = (int)CStringLength(String);
+   return(Result);
+}
+
+// NOTE (MJP): Kept for existing callers, new code should use PushStr8Cat.
+// Like before, out isn't null terminated.
+inline u32
+CatStrings (char *a, char *b, char *out)
+{
+   memory_index alen = strlen(a);
+   memory_index blen = strlen(b);
+   MemCopy(out, a, alen);
+   MemCopy(out + alen, b, blen);
+
+   u32 res = (u32)(alen + blen);
+   return (res);
+}
+
+// 
+// SECTION: FORMATTING
+// 
+//
+
+// NOTE (MJP): printf free number formatting. The Format* functions write into
+// a caller buffer of at least FORMAT_NUMBER_MAX_SIZE bytes (FormatR64Fixed
+// needs FORMAT_R64_FIXED_MAX_SIZE) and return the number of bytes written,
+// without a null terminator.
+//
+// Floats are printed with the fewest digits that read back (strtod/strtof) to
+// the same value, using Grisu2 (Loitsch, "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers") rather than Ryu: it needs one table
+// of 87 cached powers of ten instead of Ryu's multi-kilobyte tables, always
+// round-trips, and is shortest for all but a tiny fraction of inputs, where
+// it prints one digit more. Output looks like "1.0", "0.001", "123.45",
+// "1e+30", "1.5e-07", "nan", "inf".
+
+#define FORMAT_NUMBER_MAX_SIZE 32
+// NOTE (MJP): Bigger precisions are clamped to this.
+#define FORMAT_MAX_FIXED_PRECISION 64
+// NOTE (MJP): Sign, 309 integer digits of DBL_MAX, point and fraction.
+#define FORMAT_R64_FIXED_MAX_SIZE (1 + 309 + 1 + FORMAT_MAX_FIXED_PRECISION)
+
+global_variable char FormatDigitPairs[201] =
+   "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+   "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+   "8081828384858687888990919293949596979899";
+
+global_variable u64 FormatPow10[20] =
+{
+   1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+   100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+   10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+   100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+};
+
+inline u32
+CountDecimalDigits(u64 Value)
+{
+   u32 Result = 1;
+   while ((Result < 20) && (Value >= FormatPow10[Result]))
+   {
+      ++Result;
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Two digits per divide, written back to front.
+inline void
+WriteDecimalDigits_(u8 *End, u64 Value)
+{
+   while (Value >= 100)
+   {
+      u32 Pair = (u32)(Value % 100);
+      Value /= 100;
+      End -= 2;
+      End[0] = FormatDigitPairs[2*Pair];
+      End[1] = FormatDigitPairs[2*Pair + 1];
+   }
+   if (Value >= 10)
+   {
+      End -= 2;
+      End[0] = FormatDigitPairs[2*Value];
+      End[1] = FormatDigitPairs[2*Value + 1];
+   }
+   else
+   {
+      *--End = (u8)('0' + Value);
+   }
+}
+
+inline u32
+FormatU64(u8 *Out, u64 Value)
+{
+   u32 Result = CountDecimalDigits(Value);
+   WriteDecimalDigits_(Out + Result, Value);
+   return(Result);
+}
+
+inline u32
+FormatS64(u8 *Out, s64 Value)
+{
+   u32 Result = 0;
+   u64 Magnitude = (u64)Value;
+   if (Value < 0)
+   {
+      Out[Result++] = '-';
+      Magnitude = 0 - Magnitude;
+   }
+   Result += FormatU64(Out + Result, Magnitude);
+   return(Result);
+}
+
+inline u32
+FormatU32(u8 *Out, u32 Value)
+{
+   u32 Result = FormatU64(Out, Value);
+   return(Result);
+}
+
+inline u32
+FormatS32(u8 *Out, s32 Value)
+{
+   u32 Result = FormatS64(Out, Value);
+   return(Result);
+}
+
+// NOTE (MJP): No 0x prefix. Pads with zeros to at least MinDigits.
+function u32
+FormatHex64(u8 *Out, u64 Value, u32 MinDigits = 1, b32 Uppercase = false)
+{
+   u8 *Digits = (u8 *)(Uppercase ? "0123456789ABCDEF" : "0123456789abcdef");
+   u32 DigitCount = 1;
+   while ((DigitCount < 16) && (Value >> (4*DigitCount)))
+   {
+      ++DigitCount;
+   }
+   u32 Result = Max(DigitCount, Min(MinDigits, (u32)(FORMAT_NUMBER_MAX_SIZE - 1)));
+   for (u32 Index = 0; Index < Result; ++Index)
+   {
+      u32 Shift = 4*(Result - 1 - Index);
+      Out[Index] = (Shift < 64) ? Digits[(Value >> Shift) & 0xF] : '0';
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Grisu2, after Milo Yip's implementation. diy_fp is F*2^E
+// with a full 64 bit significand.
+struct diy_fp
+{
+   u64 F;
+   s32 E;
+};
+
+global_variable diy_fp GrisuCachedPowers[87] =
+{
+   {0xfa8fd5a0081c0288ull, -1220}, {0xbaaee17fa23ebf76ull, -1193}, {0x8b16fb203055ac76ull, -1166},
+   {0xcf42894a5dce35eaull, -1140}, {0x9a6bb0aa55653b2dull, -1113}, {0xe61acf033d1a45dfull, -1087},
+   {0xab70fe17c79ac6caull, -1060}, {0xff77b1fcbebcdc4full, -1034}, {0xbe5691ef416bd60cull, -1007},
+   {0x8dd01fad907ffc3cull, -980}, {0xd3515c2831559a83ull, -954}, {0x9d71ac8fada6c9b5ull, -927},
+   {0xea9c227723ee8bcbull, -901}, {0xaecc49914078536dull, -874}, {0x823c12795db6ce57ull, -847},
+   {0xc21094364dfb5637ull, -821}, {0x9096ea6f3848984full, -794}, {0xd77485cb25823ac7ull, -768},
+   {0xa086cfcd97bf97f4ull, -741}, {0xef340a98172aace5ull, -715}, {0xb23867fb2a35b28eull, -688},
+   {0x84c8d4dfd2c63f3bull, -661}, {0xc5dd44271ad3cdbaull, -635}, {0x936b9fcebb25c996ull, -608},
+   {0xdbac6c247d62a584ull, -582}, {0xa3ab66580d5fdaf6ull, -555}, {0xf3e2f893dec3f126ull, -529},
+   {0xb5b5ada8aaff80b8ull, -502}, {0x87625f056c7c4a8bull, -475}, {0xc9bcff6034c13053ull, -449},
+   {0x964e858c91ba2655ull, -422}, {0xdff9772470297ebdull, -396}, {0xa6dfbd9fb8e5b88full, -369},
+   {0xf8a95fcf88747d94ull, -343}, {0xb94470938fa89bcfull, -316}, {0x8a08f0f8bf0f156bull, -289},
+   {0xcdb02555653131b6ull, -263}, {0x993fe2c6d07b7facull, -236}, {0xe45c10c42a2b3b06ull, -210},
+   {0xaa242499697392d3ull, -183}, {0xfd87b5f28300ca0eull, -157}, {0xbce5086492111aebull, -130},
+   {0x8cbccc096f5088ccull, -103}, {0xd1b71758e219652cull, -77}, {0x9c40000000000000ull, -50},
+   {0xe8d4a51000000000ull, -24}, {0xad78ebc5ac620000ull, 3}, {0x813f3978f8940984ull, 30},
+   {0xc097ce7bc90715b3ull, 56}, {0x8f7e32ce7bea5c70ull, 83}, {0xd5d238a4abe98068ull, 109},
+   {0x9f4f2726179a2245ull, 136}, {0xed63a231d4c4fb27ull, 162}, {0xb0de65388cc8ada8ull, 189},
+   {0x83c7088e1aab65dbull, 216}, {0xc45d1df942711d9aull, 242}, {0x924d692ca61be758ull, 269},
+   {0xda01ee641a708deaull, 295}, {0xa26da3999aef774aull, 322}, {0xf209787bb47d6b85ull, 348},
+   {0xb454e4a179dd1877ull, 375}, {0x865b86925b9bc5c2ull, 402}, {0xc83553c5c8965d3dull, 428},
+   {0x952ab45cfa97a0b3ull, 455}, {0xde469fbd99a05fe3ull, 481}, {0xa59bc234db398c25ull, 508},
+   {0xf6c69a72a3989f5cull, 534}, {0xb7dcbf5354e9beceull, 561}, {0x88fcf317f22241e2ull, 588},
+   {0xcc20ce9bd35c78a5ull, 614}, {0x98165af37b2153dfull, 641}, {0xe2a0b5dc971f303aull, 667},
+   {0xa8d9d1535ce3b396ull, 694}, {0xfb9b7cd9a4a7443cull, 720}, {0xbb764c4ca7a44410ull, 747},
+   {0x8bab8eefb6409c1aull, 774}, {0xd01fef10a657842cull, 800}, {0x9b10a4e5e9913129ull, 827},
+   {0xe7109bfba19c0c9dull, 853}, {0xac2820d9623bf429ull, 880}, {0x80444b5e7aa7cf85ull, 907},
+   {0xbf21e44003acdd2dull, 933}, {0x8e679c2f5e44ff8full, 960}, {0xd433179d9c8cb841ull, 986},
+   {0x9e19db92b4e31ba9ull, 1013}, {0xeb96bf6ebadf77d9ull, 1039}, {0xaf87023b9bf0ee6bull, 1066}
+};
+
+inline diy_fp
+DiyFp(u64 F, s32 E)
+{
+   diy_fp Result = {F, E};
+   return(Result);
+}
+
+// NOTE (MJP): High 64 bits of the 128 bit product, rounded.
+inline diy_fp
+MultiplyDiyFp(diy_fp A, diy_fp B)
+{
+   u64 M32 = 0xFFFFFFFFull;
+   u64 AHi = A.F >> 32, ALo = A.F & M32;
+   u64 BHi = B.F >> 32, BLo = B.F & M32;
+   u64 HiHi = AHi*BHi, HiLo = AHi*BLo, LoHi = ALo*BHi, LoLo = ALo*BLo;
+   u64 Middle = (LoLo >> 32) + (HiLo & M32) + (LoHi & M32) + (1ull << 31);
+   diy_fp Result = {HiHi + (HiLo >> 32) + (LoHi >> 32) + (Middle >> 32), A.E + B.E + 64};
+   return(Result);
+}
+
+inline diy_fp
+NormalizeDiyFp(diy_fp Value)
+{
+   while (!(Value.F & (1ull << 63)))
+   {
+      Value.F <<= 1;
+      --Value.E;
+   }
+   return(Value);
+}
+
+// NOTE (MJP): Returns the cached power c with -60 <= E + c.E <= -32 and sets
+// K so that c ~= 10^-K.
+inline diy_fp
+GetGrisuCachedPower(s32 E, s32 *K)
+{
+   r64 DK = (-61 - E)*0.30102999566398114 + 347;
+   s32 IntK = (s32)DK;
+   if ((DK - IntK) > 0.0)
+   {
+      ++IntK;
+   }
+   u32 Index = (u32)((IntK >> 3) + 1);
+   *K = -(-348 + (s32)(Index << 3));
+   diy_fp Result = GrisuCachedPowers[Index];
+   return(Result);
+}
+
+inline void
+GrisuRound_(u8 *Digits, u32 Length, u64 Delta, u64 Rest, u64 TenKappa, u64 DistanceToHigh)
+{
+   while ((Rest < DistanceToHigh) && ((Delta - Rest) >= TenKappa) &&
+          (((Rest + TenKappa) < DistanceToHigh) ||
+           ((DistanceToHigh - Rest) > (Rest + TenKappa - DistanceToHigh))))
+   {
+      --Digits[Length - 1];
+      Rest += TenKappa;
+   }
+}
+
+// NOTE (MJP): Generates the digits of High until they are within Delta of it,
+// then rounds towards W.
+function u32
+GrisuDigitGen_(diy_fp W, diy_fp High, u64 Delta, u8 *Digits, s32 *K)
+{
+   diy_fp One = DiyFp(1ull << -High.E, High.E);
+   u64 DistanceToHigh = High.F - W.F;
+   u32 IntegerPart = (u32)(High.F >> -One.E);
+   u64 FractionPart = High.F & (One.F - 1);
+   s32 Kappa = (s32)CountDecimalDigits(IntegerPart);
+   u32 Length = 0;
+
+   while (Kappa > 0)
+   {
+      u32 Divisor = (u32)FormatPow10[Kappa - 1];
+      u32 Digit = IntegerPart / Divisor;
+      IntegerPart %= Divisor;
+      if (Digit || Length)
+      {
+         Digits[Length++] = (u8)('0' + Digit);
+      }
+      --Kappa;
+
+      u64 Rest = ((u64)IntegerPart << -One.E) + FractionPart;
+      if (Rest <= Delta)
+      {
+         *K += Kappa;
+         GrisuRound_(Digits, Length, Delta, Rest, FormatPow10[Kappa] << -One.E, DistanceToHigh);
+         return(Length);
+      }
+   }
+
+   for (;;)
+   {
+      FractionPart *= 10;
+      Delta *= 10;
+      u32 Digit = (u32)(FractionPart >> -One.E);
+      if (Digit || Length)
+      {
+         Digits[Length++] = (u8)('0' + Digit);
+      }
+      FractionPart &= One.F - 1;
+      --Kappa;
+
+      if (FractionPart < Delta)
+      {
+         *K += Kappa;
+         GrisuRound_(Digits, Length, Delta, FractionPart, One.F, DistanceToHigh*FormatPow10[-Kappa]);
+         return(Length);
+      }
+   }
+}
+
+// NOTE (MJP): Value = F*2^E, finite and positive. The rounding interval is
+// half way to the neighbours at the given significand size, so the same code
+// gives the shortest digits for r32 and r64. Digits*10^K is the result.
+function u32
+Grisu2_(u64 F, s32 E, b32 LowerIsCloser, u8 *Digits, s32 *K)
+{
+   diy_fp Value = DiyFp(F, E);
+   diy_fp High = NormalizeDiyFp(DiyFp((F << 1) + 1, E - 1));
+   diy_fp Low = LowerIsCloser ? DiyFp((F << 2) - 1, E - 2) : DiyFp((F << 1) - 1, E - 1);
+   Low.F <<= Low.E - High.E;
+   Low.E = High.E;
+
+   diy_fp CachedPower = GetGrisuCachedPower(High.E, K);
+   diy_fp W = MultiplyDiyFp(NormalizeDiyFp(Value), CachedPower);
+   diy_fp ScaledHigh = MultiplyDiyFp(High, CachedPower);
+   diy_fp ScaledLow = MultiplyDiyFp(Low, CachedPower);
+   ++ScaledLow.F;
+   --ScaledHigh.F;
+
+   u32 Result = GrisuDigitGen_(W, ScaledHigh, ScaledHigh.F - ScaledLow.F, Digits, K);
+   return(Result);
+}
+
+inline u32
+WriteDecimalExponent_(u8 *Out, s32 Exponent)
+{
+   u32 Result = 0;
+   Out[Result++] = 'e';
+   Out[Result++] = (Exponent < 0) ? '-' : '+';
+   u32 Magnitude = (u32)((Exponent < 0) ? -Exponent : Exponent);
+   if (Magnitude < 10)
+   {
+      Out[Result++] = '0';
+   }
+   Result += FormatU64(Out + Result, Magnitude);
+   return(Result);
+}
+
+// NOTE (MJP): Lays out Length digits times 10^K, in place (Out holds the
+// digits on entry).
+function u32
+PrettifyDecimal_(u8 *Out, u32 Length, s32 K)
+{
+   // NOTE (MJP): 10^(DecimalPoint - 1) <= Value < 10^DecimalPoint.
+   s32 DecimalPoint = (s32)Length + K;
+   u32 Result = 0;
+   if ((K >= 0) && (DecimalPoint <= 21))
+   {
+      // NOTE (MJP): 1234e7 -> 12340000000.0
+      for (s32 Index = (s32)Length; Index < DecimalPoint; ++Index)
+      {
+         Out[Index] = '0';
+      }
+      Out[DecimalPoint] = '.';
+      Out[DecimalPoint + 1] = '0';
+      Result = DecimalPoint + 2;
+   }
+   else if ((DecimalPoint > 0) && (DecimalPoint <= 21))
+   {
+      // NOTE (MJP): 1234e-2 -> 12.34
+      MemMove(Out + DecimalPoint + 1, Out + DecimalPoint, Length - DecimalPoint);
+      Out[DecimalPoint] = '.';
+      Result = Length + 1;
+   }
+   else if ((DecimalPoint > -6) && (DecimalPoint <= 0))
+   {
+      // NOTE (MJP): 1234e-6 -> 0.001234
+      u32 Offset = 2 - DecimalPoint;
+      MemMove(Out + Offset, Out, Length);
+      Out[0] = '0';
+      Out[1] = '.';
+      for (u32 Index = 2; Index < Offset; ++Index)
+      {
+         Out[Index] = '0';
+      }
+      Result = Length + Offset;
+   }
+   else if (Length == 1)
+   {
+      // NOTE (MJP): 1e30
+      Result = 1 + WriteDecimalExponent_(Out + 1, DecimalPoint - 1);
+   }
+   else
+   {
+      // NOTE (MJP): 1234e30 -> 1.234e+33
+      MemMove(Out + 2, Out + 1, Length - 1);
+      Out[1] = '.';
+      Result = Length + 1 + WriteDecimalExponent_(Out + Length + 1, DecimalPoint - 1);
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Shared by FormatR64 and FormatR32 once the bits are split.
+function u32
+FormatFloatBits_(u8 *Out, b32 Negative, u64 Mantissa, u32 BiasedExponent,
+                 u32 MantissaBits, u32 ExponentMax, s32 ExponentBias)
+{
+   u32 Result = 0;
+   if (BiasedExponent == ExponentMax)
+   {
+      if (Mantissa)
+      {
+         MemCopy(Out, (u8 *)"nan", 3);
+         return(3);
+      }
+      if (Negative)
+      {
+         Out[Result++] = '-';
+      }
+      MemCopy(Out + Result, (u8 *)"inf", 3);
+      return(Result + 3);
+   }
+
+   if (Negative)
+   {
+      Out[Result++] = '-';
+   }
+   if (!BiasedExponent && !Mantissa)
+   {
+      MemCopy(Out + Result, (u8 *)"0.0", 3);
+      return(Result + 3);
+   }
+
+   u64 F = Mantissa;
+   s32 E = 1 - ExponentBias - (s32)MantissaBits;
+   b32 LowerIsCloser = false;
+   if (BiasedExponent)
+   {
+      F |= (1ull << MantissaBits);
+      E = (s32)BiasedExponent - ExponentBias - (s32)MantissaBits;
+      LowerIsCloser = (Mantissa == 0) && (BiasedExponent > 1);
+   }
+
+   s32 K = 0;
+   u32 Length = Grisu2_(F, E, LowerIsCloser, Out + Result, &K);
+   Result += PrettifyDecimal_(Out + Result, Length, K);
+   return(Result);
+}
+
+function u32
+FormatR64(u8 *Out, r64 Value)
+{
+   u64 Bits;
+   memcpy(&Bits, &Value, SizeOf(Bits));
+   u32 Result = FormatFloatBits_(Out, (b32)(Bits >> 63), Bits & ((1ull << 52) - 1),
+                                 (u32)((Bits >> 52) & 0x7FF), 52, 0x7FF, 1023);
+   return(Result);
+}
+
+function u32
+FormatR32(u8 *Out, r32 Value)
+{
+   u32 Bits;
+   memcpy(&Bits, &Value, SizeOf(Bits));
+   u32 Result = FormatFloatBits_(Out, (b32)(Bits >> 31), Bits & ((1u << 23) - 1),
+                                 (Bits >> 23) & 0xFF, 23, 0xFF, 127);
+   return(Result);
+}
+
+// NOTE (MJP): Little endian u32 limbs, enough for the 1024 bit integer part
+// of DBL_MAX and for the 1074 bit fraction of the smallest subnormal (plus
+// room for one multiply by 10).
+#define FORMAT_BIGNUM_LIMB_COUNT 36
+
+struct format_bignum
+{
+   u32 Limbs[FORMAT_BIGNUM_LIMB_COUNT];
+   u32 Count;
+};
+
+// NOTE (MJP): Sets Number to Value*2^Shift.
+inline void
+SetBignumShifted_(format_bignum *Number, u64 Value, u32 Shift)
+{
+   ZeroStruct(*Number);
+   u32 LimbIndex = Shift / 32;
+   u32 BitShift = Shift % 32;
+   u64 Low = Value << BitShift;
+   u64 High = BitShift ? (Value >> (64 - BitShift)) : 0;
+   Number->Limbs[LimbIndex] = (u32)Low;
+   Number->Limbs[LimbIndex + 1] = (u32)(Low >> 32);
+   Number->Limbs[LimbIndex + 2] = (u32)High;
+   Number->Count = LimbIndex + 3;
+   while (Number->Count && !Number->Limbs[Number->Count - 1])
+   {
+      --Number->Count;
+   }
+}
+
+inline void
+MultiplyBignum10_(format_bignum *Number)
+{
+   u64 Carry = 0;
+   for (u32 LimbIndex = 0; LimbIndex < Number->Count; ++LimbIndex)
+   {
+      u64 Product = (u64)Number->Limbs[LimbIndex]*10 + Carry;
+      Number->Limbs[LimbIndex] = (u32)Product;
+      Carry = Product >> 32;
+   }
+   if (Carry)
+   {
+      Assert(Number->Count < FORMAT_BIGNUM_LIMB_COUNT);
+      Number->Limbs[Number->Count++] = (u32)Carry;
+   }
+}
+
+// NOTE (MJP): Divides in place, returning the remainder.
+inline u32
+DivideBignum_(format_bignum *Number, u32 Divisor)
+{
+   u64 Remainder = 0;
+   for (u32 LimbIndex = Number->Count; LimbIndex-- > 0;)
+   {
+      u64 Current = (Remainder << 32) | Number->Limbs[LimbIndex];
+      Number->Limbs[LimbIndex] = (u32)(Current / Divisor);
+      Remainder = Current % Divisor;
+   }
+   while (Number->Count && !Number->Limbs[Number->Count - 1])
+   {
+      --Number->Count;
+   }
+   return((u32)Remainder);
+}
+
+// NOTE (MJP): Returns the bits of Number at and above Bit (at most 4 of them
+// after a multiply by 10) and clears them.
+inline u32
+TakeBignumBitsAbove_(format_bignum *Number, u32 Bit)
+{
+   u32 LimbIndex = Bit / 32;
+   u32 BitShift = Bit % 32;
+   u64 Top = 0;
+   if (LimbIndex < Number->Count)
+   {
+      Top = Number->Limbs[LimbIndex];
+      if ((LimbIndex + 1) < Number->Count)
+      {
+         Top |= (u64)Number->Limbs[LimbIndex + 1] << 32;
+      }
+   }
+   u32 Result = (u32)(Top >> BitShift);
+
+   if (LimbIndex < Number->Count)
+   {
+      Number->Limbs[LimbIndex] &= (u32)((1ull << BitShift) - 1);
+      Number->Count = LimbIndex + 1;
+      while (Number->Count && !Number->Limbs[Number->Count - 1])
+      {
+         --Number->Count;
+      }
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Compares the fraction Number/2^Bits with one half, returns
+// < 0, 0 or > 0.
+inline s32
+CompareBignumWithHalf_(format_bignum *Number, u32 Bits)
+{
+   format_bignum Half;
+   SetBignumShifted_(&Half, 1, Bits - 1);
+   s32 Result = 0;
+   for (u32 LimbIndex = Max(Number->Count, Half.Count); LimbIndex-- > 0;)
+   {
+      u32 A = (LimbIndex < Number->Count) ? Number->Limbs[LimbIndex] : 0;
+      u32 B = (LimbIndex < Half.Count) ? Half.Limbs[LimbIndex] : 0;
+      if (A != B)
+      {
+         Result = (A < B) ? -1 : 1;
+         break;
+      }
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Decimal digits of an integer wider than 64 bits, 9 at a time.
+function u32
+FormatBignum_(u8 *Out, format_bignum *Number)
+{
+   u32 Chunks[40];
+   u32 ChunkCount = 0;
+   do
+   {
+      Chunks[ChunkCount++] = DivideBignum_(Number, 1000000000);
+   } while (Number->Count);
+
+   u32 Result = FormatU64(Out, Chunks[--ChunkCount]);
+   while (ChunkCount--)
+   {
+      u32 Chunk = Chunks[ChunkCount];
+      for (u32 Digit = 9; Digit-- > 0;)
+      {
+         Out[Result + Digit] = (u8)('0' + Chunk % 10);
+         Chunk /= 10;
+      }
+      Result += 9;
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Precision digits after the point, like "%.*f", exact for every
+// r64: the value is M*2^E, so the integer part is M shifted (a bignum when it
+// doesn't fit a u64) and each fraction digit is the next multiply by 10 of
+// the remaining bits. Rounding is to nearest with ties to even, on the exact
+// value, which is what glibc's printf does (0.125 -> "0.12", 2.675 -> "2.67"
+// since 2.675 is really 2.67499...). Out needs FORMAT_R64_FIXED_MAX_SIZE
+// bytes. nan and inf print as in FormatR64.
+function u32
+FormatR64Fixed(u8 *Out, r64 Value, u32 Precision)
+{
+   u64 Bits;
+   memcpy(&Bits, &Value, SizeOf(Bits));
+   u64 Mantissa = Bits & ((1ull << 52) - 1);
+   u32 BiasedExponent = (u32)((Bits >> 52) & 0x7FF);
+   if (BiasedExponent == 0x7FF)
+   {
+      u32 Result = FormatR64(Out, Value);
+      return(Result);
+   }
+
+   u32 Result = 0;
+   if (Bits >> 63)
+   {
+      Out[Result++] = '-';
+   }
+   Precision = Min(Precision, (u32)FORMAT_MAX_FIXED_PRECISION);
+
+   s32 Exponent = -1074;
+   if (BiasedExponent)
+   {
+      Mantissa |= (1ull << 52);
+      Exponent = (s32)BiasedExponent - 1075;
+   }
+
+   // NOTE (MJP): Integer part.
+   u8 *IntegerStart = Out + Result;
+   if (Exponent >= 0)
+   {
+      if (Exponent <= 11)
+      {
+         Result += FormatU64(Out + Result, Mantissa << Exponent);
+      }
+      else
+      {
+         format_bignum Integer;
+         SetBignumShifted_(&Integer, Mantissa, (u32)Exponent);
+         Result += FormatBignum_(Out + Result, &Integer);
+      }
+   }
+   else
+   {
+      u32 FractionBits = (u32)-Exponent;
+      Result += FormatU64(Out + Result, (FractionBits < 64) ? (Mantissa >> FractionBits) : 0);
+   }
+
+   // NOTE (MJP): Fraction digits, then which way to round. RoundUp is > 0 to
+   // round up, 0 on an exact tie, < 0 to round down.
+   if (Precision)
+   {
+      Out[Result++] = '.';
+   }
+   s32 RoundUp = -1;
+   if (Exponent >= 0)
+   {
+      for (u32 Digit = 0; Digit < Precision; ++Digit)
+      {
+         Out[Result++] = '0';
+      }
+   }
+   else
+   {
+      u32 FractionBits = (u32)-Exponent;
+      if (FractionBits <= 60)
+      {
+         u64 Mask = (1ull << FractionBits) - 1;
+         u64 Fraction = Mantissa & Mask;
+         for (u32 Digit = 0; Digit < Precision; ++Digit)
+         {
+            Fraction *= 10;
+            Out[Result++] = (u8)('0' + (Fraction >> FractionBits));
+            Fraction &= Mask;
+         }
+         u64 Half = 1ull << (FractionBits - 1);
+         RoundUp = (Fraction > Half) ? 1 : ((Fraction == Half) ? 0 : -1);
+      }
+      else
+      {
+         format_bignum Fraction;
+         SetBignumShifted_(&Fraction, (FractionBits < 64) ? (Mantissa & ((1ull << FractionBits) - 1)) : Mantissa, 0);
+         for (u32 Digit = 0; Digit < Precision; ++Digit)
+         {
+            MultiplyBignum10_(&Fraction);
+            Out[Result++] = (u8)('0' + TakeBignumBitsAbove_(&Fraction, FractionBits));
+         }
+         RoundUp = CompareBignumWithHalf_(&Fraction, FractionBits);
+      }
+   }
+
+   u8 LastDigit = Out[Result - 1];
+   if ((RoundUp > 0) || ((RoundUp == 0) && ((LastDigit - '0') & 1)))
+   {
+      // NOTE (MJP): Carry back through the digits, skipping the point. A
+      // carry out of the top digit needs one more digit in front.
+      u8 *At = Out + Result;
+      b32 Carry = true;
+      while (Carry && (At > IntegerStart))
+      {
+         --At;
+         if (*At == '.')
+         {
+            continue;
+         }
+         if (*At == '9')
+         {
+            *At = '0';
+         }
+         else
+         {
+            ++*At;
+            Carry = false;
+         }
+      }
+      if (Carry)
+      {
+         MemMove(IntegerStart + 1, IntegerStart, (Out + Result) - IntegerStart);
+         *IntegerStart = '1';
+         ++Result;
+      }
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Format buffer, a small printf replacement on top of the above.
+// Writes are bounds checked: once the buffer is full further output is
+// dropped but still counted in Used, so a buffer with Size 0 measures how
+// much space a format needs. Formats support:
+//
+//    %d %i %u          s32, u32
+//    %ld %lld %lu %llu s64, u64 (also %li, %lli)
+//    %x %X %llx %llX   hex u32/u64, no prefix
+//    %f                r64, shortest round-trip (NOT printf's 6 digits)
+//    %hf               r32 passed as double, shortest as an r32 (0.1f -> 0.1)
+//    %.Nf              r64 with N fraction digits
+//    %c %s %S %%       char, C string, string8
+//
+// An optional width (with a leading 0 to zero pad) right aligns integers,
+// hex and strings, e.g. %08x or %4d.
+
+struct format_buffer
+{
+   u8 *Base;
+   u64 Size;
+   u64 Used;
+};
+
+inline void
+InitializeFormatBuffer(format_buffer *Buffer, void *Base, u64 Size)
+{
+   Buffer->Base = (u8 *)Base;
+   Buffer->Size = Size;
+   Buffer->Used = 0;
+}
+
+inline b32
+FormatBufferOverflowed(format_buffer *Buffer)
+{
+   b32 Result = (Buffer->Used > Buffer->Size);
+   return(Result);
+}
+
+inline void
+AppendBytes(format_buffer *Buffer, u8 *Bytes, u64 Size)
+{
+   if (Buffer->Used < Buffer->Size)
+   {
+      MemCopy(Buffer->Base + Buffer->Used, Bytes, Min(Size, Buffer->Size - Buffer->Used));
+   }
+   Buffer->Used += Size;
+}
+
+inline void
+AppendChar(format_buffer *Buffer, u8 Char)
+{
+   if (Buffer->Used < Buffer->Size)
+   {
+      Buffer->Base[Buffer->Used] = Char;
+   }
+   ++Buffer->Used;
+}
+
+inline void
+AppendStr8(format_buffer *Buffer, string8 String)
+{
+   AppendBytes(Buffer, String.Str, String.Size);
+}
+
+inline void
+AppendPadding_(format_buffer *Buffer, u64 Width, u64 Size, u8 Pad)
+{
+   for (u64 Index = Size; Index < Width; ++Index)
+   {
+      AppendChar(Buffer, Pad);
+   }
+}
+
+inline void
+AppendS64(format_buffer *Buffer, s64 Value)
+{
+   u8 Temp[FORMAT_NUMBER_MAX_SIZE];
+   AppendBytes(Buffer, Temp, FormatS64(Temp, Value));
+}
+
+inline void
+AppendU64(format_buffer *Buffer, u64 Value)
+{
+   u8 Temp[FORMAT_NUMBER_MAX_SIZE];
+   AppendBytes(Buffer, Temp, FormatU64(Temp, Value));
+}
+
+inline void
+AppendHex64(format_buffer *Buffer, u64 Value, u32 MinDigits = 1, b32 Uppercase = false)
+{
+   u8 Temp[FORMAT_NUMBER_MAX_SIZE];
+   AppendBytes(Buffer, Temp, FormatHex64(Temp, Value, MinDigits, Uppercase));
+}
+
+inline void
+AppendR64(format_buffer *Buffer, r64 Value)
+{
+   u8 Temp[FORMAT_NUMBER_MAX_SIZE];
+   AppendBytes(Buffer, Temp, FormatR64(Temp, Value));
+}
+
+inline void
+AppendR32(format_buffer *Buffer, r32 Value)
+{
+   u8 Temp[FORMAT_NUMBER_MAX_SIZE];
+   AppendBytes(Buffer, Temp, FormatR32(Temp, Value));
+}
+
+inline void
+AppendR64Fixed(format_buffer *Buffer, r64 Value, u32 Precision)
+{
+   u8 Temp[FORMAT_R64_FIXED_MAX_SIZE];
+   AppendBytes(Buffer, Temp, FormatR64Fixed(Temp, Value, Precision));
+}
+
+function void
+AppendFormatV(format_buffer *Buffer, char *Format, va_list Args)
+{
+   u8 *At = (u8 *)Format;
+   while (*At)
+   {
+      u8 *Literal = At;
+      while (*At && (*At != '%'))
+      {
+         ++At;
+      }
+      AppendBytes(Buffer, Literal, (u64)(At - Literal));
+      if (!*At)
+      {
+         break;
+      }
+
+      ++At;
+      u8 Pad = ' ';
+      if (*At == '0')
+      {
+         Pad = '0';
+         ++At;
+      }
+      u32 Width = 0;
+      while ((*At >= '0') && (*At <= '9'))
+      {
+         Width = Width*10 + (*At++ - '0');
+      }
+      s32 Precision = -1;
+      if (*At == '.')
+      {
+         ++At;
+         Precision = 0;
+         while ((*At >= '0') && (*At <= '9'))
+         {
+            Precision = Precision*10 + (*At++ - '0');
+         }
+      }
+      u32 LongCount = 0;
+      b32 IsHalf = false;
+      while ((*At == 'l') || (*At == 'h'))
+      {
+         LongCount += (*At == 'l');
+         IsHalf = IsHalf || (*At == 'h');
+         ++At;
+      }
+
+      u8 Temp[FORMAT_R64_FIXED_MAX_SIZE];
+      u32 TempSize = 0;
+      string8 String = {};
+      switch (*At)
+      {
+         case 'd':
+         case 'i':
+         {
+            s64 Value = LongCount ? va_arg(Args, s64) : (s64)va_arg(Args, s32);
+            TempSize = FormatS64(Temp, Value);
+         } break;
+
+         case 'u':
+         {
+            u64 Value = LongCount ? va_arg(Args, u64) : (u64)va_arg(Args, u32);
+            TempSize = FormatU64(Temp, Value);
+         } break;
+
+         case 'x':
+         case 'X':
+         {
+            u64 Value = LongCount ? va_arg(Args, u64) : (u64)va_arg(Args, u32);
+            TempSize = FormatHex64(Temp, Value, (Pad == '0') ? Max(Width, 1u) : 1, *At == 'X');
+         } break;
+
+         case 'f':
+         {
+            r64 Value = va_arg(Args, r64);
+            if (Precision >= 0)
+            {
+               TempSize = FormatR64Fixed(Temp, Value, (u32)Precision);
+            }
+            else
+            {
+               TempSize = IsHalf ? FormatR32(Temp, (r32)Value) : FormatR64(Temp, Value);
+            }
+         } break;
+
+         case 'c':
+         {
+            Temp[0] = (u8)va_arg(Args, int);
+            TempSize = 1;
+         } break;
+
+         case 's':
+         {
+            String = Str8C(va_arg(Args, char *));
+         } break;
+
+         case 'S':
+         {
+            String = va_arg(Args, string8);
+         } break;
+
+         case '%':
+         {
+            Temp[0] = '%';
+            TempSize = 1;
+         } break;
+
+         default:
+         {
+            AssertPrint(0, "AppendFormat: unsupported conversion");
+            // NOTE (MJP): Keep the text so the mistake shows up in the output.
+            AppendChar(Buffer, '%');
+            if (!*At)
+            {
+               return;
+            }
+            Temp[0] = *At;
+            TempSize = 1;
+         } break;
+      }
+      ++At;
+
+      if (TempSize)
+      {
+         String = Str8(Temp, TempSize);
+      }
+      else
+      {
+         // NOTE (MJP): Strings are only ever space padded.
+         Pad = ' ';
+      }
+      if ((Pad == '0') && (String.Str[0] == '-'))
+      {
+         // NOTE (MJP): Zero padding goes after the sign.
+         AppendChar(Buffer, '-');
+         String = Str8Skip(String, 1);
+         Width = Width ? (Width - 1) : 0;
+      }
+      AppendPadding_(Buffer, Width, String.Size, Pad);
+      AppendStr8(Buffer, String);
+   }
+}
+
+function void
+AppendFormat(format_buffer *Buffer, char *Format, ...)
+{
+   va_list Args;
+   va_start(Args, Format);
+   AppendFormatV(Buffer, Format, Args);
+   va_end(Args);
+}
+
+// NOTE (MJP): Null terminates when there's room (not counted in Size) and
+// returns what fit.
+inline string8
+GetFormatBufferString(format_buffer *Buffer)
+{
+   u64 Size = Min(Buffer->Used, Buffer->Size);
+   if (Size < Buffer->Size)
+   {
+      Buffer->Base[Size] = 0;
+   }
+   string8 Result = Str8(Buffer->Base, Size);
+   return(Result);
+}
+
+// NOTE (MJP): Same single pass strategy as PushStr8FV, formatting into the
+// arena's committed tail and only measuring and formatting again when that's
+// too small.
+function string8
+PushStr8Format(memory_arena *Arena, char *Format, ...)
+{
+   va_list Args;
+   va_start(Args, Format);
+   va_list ArgsCopy;
+   va_copy(ArgsCopy, Args);
+
+   format_buffer Buffer;
+   InitializeFormatBuffer(&Buffer, Arena->Base + Arena->Used, Arena->CommittedSize - Arena->Used);
+   AppendFormatV(&Buffer, Format, Args);
+
+   string8 Result = {};
+   if (Buffer.Used < Buffer.Size)
+   {
+      PushArray(Arena, u8, Buffer.Used + 1, 1);
+      Result = GetFormatBufferString(&Buffer);
+   }
+   else
+   {
+      u8 *Str = PushArray(Arena, u8, Buffer.Used + 1, 1);
+      if (Str)
+      {
+         InitializeFormatBuffer(&Buffer, Str, Buffer.Used + 1);
+         AppendFormatV(&Buffer, Format, ArgsCopy);
+         Result = GetFormatBufferString(&Buffer);
+      }
+   }
+
+   va_end(ArgsCopy);
+   va_end(Args);
+   return(Result);
+}
+
+//
+// SECTION: CHUNK ALLOCATOR
+//
+// This is a basic heap allocator, that operates with a fixed chunk size to
+// reduce fragmentation and the realloc frequency. 
+//
+// Chunk size, chunk count and alignment are set per instance with
+// chunk_allocator_params, so e.g. a small chunk allocator for nodes and a
+// page sized chunk allocator for audio buffers can live side by side.
+//
+// The whole heap (header, regions, boundary tags and chunk memory) lives in
+// one reserved block, and every link inside it is an index rather than a
+// pointer. So the block can be written out and read back anywhere with
+// SaveAllocator/LoadAllocator, and allocations referred to by chunk index
+// (see ResizeAllocationIndex) stay valid across the round trip.
+//
+
+// NOTE (MJP): Chunk allocator types
+#define CHUNK_ALLOCATOR_CHUNK_SIZE 64
+#define CHUNK_ALLOCATOR_CHUNK_COUNT (1 << 18)
+#define CHUNK_ALLOCATOR_ALIGNMENT L2_CACHE_SIZE
+
+// NOTE (MJP): Chunk allocator flags
+// Only commit chunk memory as the highest allocated chunk rises, rather than
+// committing it all up front.
+#define CHUNK_ALLOCATOR_FLAG_COMMIT_ON_DEMAND (1 << 0)
+// Decommit the committed tail once it's free (needs COMMIT_ON_DEMAND).
+#define CHUNK_ALLOCATOR_FLAG_DECOMMIT_FREE_TAIL (1 << 1)
+// Back the heap with transparent huge pages, chunk memory starts on a huge
+// page boundary.
+#define CHUNK_ALLOCATOR_FLAG_HUGE_PAGES (1 << 2)
+// Fault committed chunk memory in as it's committed, i.e. all of it at setup
+// unless COMMIT_ON_DEMAND.
+#define CHUNK_ALLOCATOR_FLAG_PREFAULT (1 << 3)
+// Prefault and mlock committed memory.
+#define CHUNK_ALLOCATOR_FLAG_LOCK_MEMORY (1 << 4)
+
+#define CHUNK_ALLOCATOR_COMMIT_SIZE KiB(64)
+// NOTE (MJP): Free committed tail has to be at least this big before it's
+// decommitted, so alloc/free at the boundary doesn't thrash.
+#define CHUNK_ALLOCATOR_DECOMMIT_THRESHOLD MiB(1)
+
+// NOTE (MJP): Define CHUNK_ALLOCATOR_STATS to 1 to track usage counters and
+// enable the incremental validator. Compiles out completely otherwise.
+#if CHUNK_ALLOCATOR_STATS
+#define ChunkStat(Statement) Statement
+#else
+#define ChunkStat(Statement)
+#endif
+
+// NOTE (MJP): Define CHUNK_ALLOCATOR_DEBUG to 1 to fill freed chunks with
+// CHUNK_ALLOCATOR_POISON and catch double frees.
+#define CHUNK_ALLOCATOR_POISON 0xDD
+#if CHUNK_ALLOCATOR_DEBUG
+#define PoisonChunks(Memory, Size) memset((Memory), CHUNK_ALLOCATOR_POISON, (Size))
+#else
+#define PoisonChunks(Memory, Size)
+#endif
+
+// NOTE (MJP): Free regions are kept in two level segregated bins (TLSF). The
+// first level is the power of two of the chunk count, the second level splits
+// each power of two linearly into CHUNK_ALLOCATOR_SL_COUNT bins.
+#define CHUNK_ALLOCATOR_SL_COUNT_LOG2 4
+#define CHUNK_ALLOCATOR_SL_COUNT (1 << CHUNK_ALLOCATOR_SL_COUNT_LOG2)
+#define CHUNK_ALLOCATOR_FL_COUNT (32 - CHUNK_ALLOCATOR_SL_COUNT_LOG2 + 1)
+#define CHUNK_ALLOCATOR_BIN_COUNT (CHUNK_ALLOCATOR_FL_COUNT*CHUNK_ALLOCATOR_SL_COUNT)
+
+// NOTE (MJP): Region indices. Index 0 is never used, so zeroed memory reads as
+// no region. The list sentinels come next, then the pool of region nodes.
+#define CHUNK_REGION_NULL 0
+#define CHUNK_REGION_ALLOCATED_SENTINEL 1
+// NOTE (MJP): For recycling chunk_regions, NOT tracking free regions
+#define CHUNK_REGION_FREE_LIST_SENTINEL 2
+#define CHUNK_REGION_FIRST_BIN_SENTINEL 3
+#define CHUNK_REGION_FIRST_NODE (CHUNK_REGION_FIRST_BIN_SENTINEL + CHUNK_ALLOCATOR_BIN_COUNT)
+
+#define CHUNK_HEAP_MAGIC 0x50414548
+#define CHUNK_HEAP_VERSION 2
+
+struct chunk_region
+{
+   u32  Next;
+   u32  Prev;
+   u32  StartIndex;
+   u32  Count;
+   b32  IsFree;
+   // NOTE (MJP): Allocated through a handle, so compaction may move it.
+   b32  IsRelocatable;
+};
+
+struct chunk_allocator_params
+{
+   // NOTE (MJP): Must be a power of 2.
+   u32 ChunkSize;
+   u32 ChunkCount;
+   // NOTE (MJP): Alignment of every allocation. Must be a power of 2, no
+   // larger than SYSTEM_PAGE_SIZE. chunk_allocator pads allocations to
+   // alignments above ChunkSize, chunk_bitmap_allocator needs it no larger
+   // than ChunkSize.
+   u32 Alignment;
+   u32 Flags;
+};
+
+// NOTE (MJP): Sits at the start of the heap block. Only brought up to date by
+// SaveAllocator, the live values are in chunk_allocator.
+struct chunk_heap_header
+{
+   u32 Magic;
+   u32 Version;
+   chunk_allocator_params Params;
+   u32 RegionCount;
+   u32 FLBitmap;
+   u32 SLBitmap[CHUNK_ALLOCATOR_FL_COUNT];
+   memory_index UsedSize;
+};
+
+// NOTE (MJP): Byte offsets from the start of the heap block.
+struct chunk_heap_layout
+{
+   memory_index RegionsOffset;
+   memory_index RegionTableOffset;
+   memory_index ChunkMemoryOffset;
+   memory_index Size;
+};
+
+#if CHUNK_ALLOCATOR_STATS
+struct chunk_allocator_stats
+{
+   // NOTE (MJP): Live values
+   u32 AllocatedChunkCount;
+   u32 AllocationCount;
+   u32 FreeRegionCount;
+
+   // NOTE (MJP): Running totals. A resize that has to move counts as an
+   // allocate and a free as well.
+   u64 AllocateCount;
+   u64 FreeCount;
+   u64 ResizeCount;
+   u64 InPlaceResizeCount;
+   u64 CopyBytes;
+
+   // NOTE (MJP): Requested sizes, bucket n counts sizes in [2^n, 2^(n+1)).
+   u64 SizeHistogram[32];
+
+   // NOTE (MJP): Chunk index the incremental validator continues from. Always
+   // kept on a region start, see SetRegionBoundaries.
+   u32 ValidateCursor;
+};
+#endif
+
+struct chunk_allocator
+{
+   u32 ChunkSize;
+   u32 ChunkSizeLog2;
+   u32 ChunkCount;
+   u32 Alignment;
+   u32 Flags;
+
+   // NOTE (MJP): Segregated bins for tracking free regions, not to be confused
+   // with the free list. FLBitmap has a bit set for each first level with a
+   // non empty bin, SLBitmap the same for each second level bin.
+   u32 FLBitmap;
+   u32 SLBitmap[CHUNK_ALLOCATOR_FL_COUNT];
+
+   // NOTE (MJP): Number of region nodes handed out so far, recycled nodes are
+   // reused before this grows.
+   u32 RegionCount;
+
+   chunk_heap_layout Layout;
+   u8 *Base;
+
+   // NOTE (MJP): Bytes of chunk memory committed.
+   memory_index CommittedSize;
+
+   chunk_region *Regions;
+
+   // NOTE (MJP): Boundary tags, indexed by chunk index. Every region (free or
+   // allocated) has its first and last chunk holding its region index, so both
+   // the pointer to region lookup and finding neighbors are constant time.
+   // Entries for chunks inside a region are stale and must not be read.
+   u32 *RegionTable;
+
+   u8 *ChunkMemory;
+
+   // NOTE (MJP): Chunk index compaction continues from, kept on a region
+   // start like the validator's cursor.
+   u32 CompactCursor;
+
+#if CHUNK_ALLOCATOR_STATS
+   chunk_allocator_stats Stats;
+#endif
+};
+
+function u32
+GetChunkCount(chunk_allocator *ChunkAllocator, u32 SizeBytes)
+{
+   u32 ChunkCount =
+      (u32)(((memory_index)SizeBytes + (ChunkAllocator->ChunkSize - 1)) >>
+            ChunkAllocator->ChunkSizeLog2);
+   return(ChunkCount);
+}
+
+function memory_index
+GetSizeBytes(chunk_allocator *ChunkAllocator, u32 ChunkCount)
+{
+   memory_index SizeBytes = (memory_index)ChunkCount << ChunkAllocator->ChunkSizeLog2;
+   return(SizeBytes);
+}
+
+function chunk_region *
+GetRegion(chunk_allocator *ChunkAllocator, u32 RegionIndex)
+{
+   chunk_region *ChunkRegion = 0;
+   if (RegionIndex != CHUNK_REGION_NULL)
+   {
+      ChunkRegion = ChunkAllocator->Regions + RegionIndex;
+   }
+   return(ChunkRegion);
+}
+
+function u32
+GetRegionIndex(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   u32 RegionIndex = (u32)(ChunkRegion - ChunkAllocator->Regions);
+   return(RegionIndex);
+}
+
+// NOTE (MJP): Index versions of the SDLL macros, for lists inside the heap.
+function void
+RegionListInit(chunk_allocator *ChunkAllocator, u32 SentinelIndex)
+{
+   chunk_region *Sentinel = ChunkAllocator->Regions + SentinelIndex;
+   Sentinel->Next = SentinelIndex;
+   Sentinel->Prev = SentinelIndex;
+}
+
+function void
+RegionListInsertAfter(chunk_allocator *ChunkAllocator, u32 BaseIndex, chunk_region *ChunkRegion)
+{
+   chunk_region *Base = ChunkAllocator->Regions + BaseIndex;
+   u32 RegionIndex = GetRegionIndex(ChunkAllocator, ChunkRegion);
+   ChunkRegion->Next = Base->Next;
+   ChunkRegion->Prev = BaseIndex;
+   ChunkAllocator->Regions[Base->Next].Prev = RegionIndex;
+   Base->Next = RegionIndex;
+}
+
+function void
+RegionListInsertBefore(chunk_allocator *ChunkAllocator, u32 BaseIndex, chunk_region *ChunkRegion)
+{
+   RegionListInsertAfter(ChunkAllocator, ChunkAllocator->Regions[BaseIndex].Prev, ChunkRegion);
+}
+
+function void
+RegionListRemove(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   ChunkAllocator->Regions[ChunkRegion->Next].Prev = ChunkRegion->Prev;
+   ChunkAllocator->Regions[ChunkRegion->Prev].Next = ChunkRegion->Next;
+   ChunkRegion->Next = CHUNK_REGION_NULL;
+   ChunkRegion->Prev = CHUNK_REGION_NULL;
+}
+
+function b32
+RegionListEmpty(chunk_allocator *ChunkAllocator, u32 SentinelIndex)
+{
+   b32 Empty = (ChunkAllocator->Regions[SentinelIndex].Next == SentinelIndex);
+   return(Empty);
+}
+
+function chunk_region *
+NewChunkRegion(chunk_allocator *ChunkAllocator, u32 StartIndex, u32 Count)
+{
+   chunk_region *ChunkRegion = 0;
+   if (RegionListEmpty(ChunkAllocator, CHUNK_REGION_FREE_LIST_SENTINEL))
+   {
+      // NOTE (MJP): There can never be more live regions than chunks, and the
+      // layout has room for that many.
+      Assert(ChunkAllocator->RegionCount < (CHUNK_REGION_FIRST_NODE + ChunkAllocator->ChunkCount));
+      ChunkRegion = ChunkAllocator->Regions + ChunkAllocator->RegionCount++;
+   }
+   else
+   {
+      ChunkRegion =
+         GetRegion(ChunkAllocator, ChunkAllocator->Regions[CHUNK_REGION_FREE_LIST_SENTINEL].Next);
+      RegionListRemove(ChunkAllocator, ChunkRegion);
+   }
+   Assert(ChunkRegion);
+   ZeroStruct(*ChunkRegion);
+
+   ChunkRegion->StartIndex = StartIndex;
+   ChunkRegion->Count = Count;
+
+   return(ChunkRegion);
+}
+
+struct chunk_bin_index
+{
+   u32 FL;
+   u32 SL;
+};
+
+// NOTE (MJP): Bin that a free region of ChunkCount chunks is stored in.
+function chunk_bin_index
+GetBinIndexForInsert(u32 ChunkCount)
+{
+   Assert(ChunkCount);
+   chunk_bin_index Result = {};
+
+   if (ChunkCount < CHUNK_ALLOCATOR_SL_COUNT)
+   {
+      Result.FL = 0;
+      Result.SL = ChunkCount;
+   }
+   else
+   {
+      u32 MSB = FindMostSignificantSetBit(ChunkCount).Index;
+      Result.FL = MSB - CHUNK_ALLOCATOR_SL_COUNT_LOG2 + 1;
+      Result.SL = (ChunkCount >> (MSB - CHUNK_ALLOCATOR_SL_COUNT_LOG2)) ^ CHUNK_ALLOCATOR_SL_COUNT;
+   }
+
+   return(Result);
+}
+
+// NOTE (MJP): First bin where every free region is guaranteed to hold
+// ChunkCount chunks, so searching never has to walk a bin.
+function chunk_bin_index
+GetBinIndexForSearch(u32 ChunkCount)
+{
+   if (ChunkCount >= CHUNK_ALLOCATOR_SL_COUNT)
+   {
+      u32 MSB = FindMostSignificantSetBit(ChunkCount).Index;
+      ChunkCount += (1 << (MSB - CHUNK_ALLOCATOR_SL_COUNT_LOG2)) - 1;
+   }
+   chunk_bin_index Result = GetBinIndexForInsert(ChunkCount);
+   return(Result);
+}
+
+function u32
+GetFreeBinSentinel(chunk_bin_index BinIndex)
+{
+   u32 SentinelIndex =
+      CHUNK_REGION_FIRST_BIN_SENTINEL + BinIndex.FL*CHUNK_ALLOCATOR_SL_COUNT + BinIndex.SL;
+   return(SentinelIndex);
+}
+
+function void
+InsertFreeRegion(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   Assert(ChunkRegion->IsFree);
+   chunk_bin_index BinIndex = GetBinIndexForInsert(ChunkRegion->Count);
+   RegionListInsertAfter(ChunkAllocator, GetFreeBinSentinel(BinIndex), ChunkRegion);
+
+   ChunkAllocator->FLBitmap |= (1 << BinIndex.FL);
+   ChunkAllocator->SLBitmap[BinIndex.FL] |= (1 << BinIndex.SL);
+   ChunkStat(++ChunkAllocator->Stats.FreeRegionCount);
+}
+
+function void
+RemoveFreeRegion(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   Assert(ChunkRegion->IsFree);
+   chunk_bin_index BinIndex = GetBinIndexForInsert(ChunkRegion->Count);
+   RegionListRemove(ChunkAllocator, ChunkRegion);
+   ChunkStat(--ChunkAllocator->Stats.FreeRegionCount);
+
+   if (RegionListEmpty(ChunkAllocator, GetFreeBinSentinel(BinIndex)))
+   {
+      ChunkAllocator->SLBitmap[BinIndex.FL] &= ~(1 << BinIndex.SL);
+      if (!ChunkAllocator->SLBitmap[BinIndex.FL])
+      {
+         ChunkAllocator->FLBitmap &= ~(1 << BinIndex.FL);
+      }
+   }
+}
+
+// NOTE (MJP): Every allocation starts on a multiple of this many chunks, 1
+// unless Alignment is bigger than ChunkSize.
+inline u32
+GetAlignmentChunkCount(chunk_allocator *ChunkAllocator)
+{
+   u32 Result = Max(ChunkAllocator->Alignment >> ChunkAllocator->ChunkSizeLog2, 1u);
+   return(Result);
+}
+
+// NOTE (MJP): Chunks from StartIndex up to the next aligned start.
+inline u32
+GetAlignmentPadding(chunk_allocator *ChunkAllocator, u32 StartIndex)
+{
+   u32 AlignmentChunkCount = GetAlignmentChunkCount(ChunkAllocator);
+   u32 Result = (AlignmentChunkCount - (StartIndex & (AlignmentChunkCount - 1))) &
+      (AlignmentChunkCount - 1);
+   return(Result);
+}
+
+// NOTE (MJP): Removes and returns a free region with at least ChunkCount
+// chunks, or 0 if there isn't one. Only ever looks at the head of one bin.
+function chunk_region *
+FindFreeRegion(chunk_allocator *ChunkAllocator, u32 ChunkCount)
+{
+   chunk_region *FoundRegion = 0;
+   chunk_bin_index BinIndex = GetBinIndexForSearch(ChunkCount);
+
+   if (BinIndex.FL < CHUNK_ALLOCATOR_FL_COUNT)
+   {
+      u32 SLMap = ChunkAllocator->SLBitmap[BinIndex.FL] & (~0u << BinIndex.SL);
+      if (!SLMap)
+      {
+         u32 FLMap = 0;
+         if ((BinIndex.FL + 1) < 32)
+         {
+            FLMap = ChunkAllocator->FLBitmap & (~0u << (BinIndex.FL + 1));
+         }
+
+         bit_scan_result FL = FindLeastSignificantSetBit(FLMap);
+         if (FL.Found)
+         {
+            BinIndex.FL = FL.Index;
+            SLMap = ChunkAllocator->SLBitmap[BinIndex.FL];
+         }
+      }
+
+      bit_scan_result SL = FindLeastSignificantSetBit(SLMap);
+      if (SL.Found)
+      {
+         BinIndex.SL = SL.Index;
+         FoundRegion =
+            GetRegion(ChunkAllocator, ChunkAllocator->Regions[GetFreeBinSentinel(BinIndex)].Next);
+         Assert(FoundRegion->Count >= ChunkCount);
+         RemoveFreeRegion(ChunkAllocator, FoundRegion);
+      }
+   }
+
+   return(FoundRegion);
+}
+
+// NOTE (MJP): Takes a region out of whichever list it's in and recycles it.
+function void
+RemoveChunkRegion(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   if (ChunkRegion->IsFree)
+   {
+      RemoveFreeRegion(ChunkAllocator, ChunkRegion);
+   }
+   else
+   {
+      RegionListRemove(ChunkAllocator, ChunkRegion);
+   }
+   RegionListInsertAfter(ChunkAllocator, CHUNK_REGION_FREE_LIST_SENTINEL, ChunkRegion);
+}
+
+
+function void
+SetRegionBoundaries(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   Assert(ChunkRegion->Count);
+   u32 RegionIndex = GetRegionIndex(ChunkAllocator, ChunkRegion);
+   ChunkAllocator->RegionTable[ChunkRegion->StartIndex] = RegionIndex;
+   ChunkAllocator->RegionTable[ChunkRegion->StartIndex + ChunkRegion->Count - 1] = RegionIndex;
+
+   // NOTE (MJP): Every change to the tiling goes through here, so snapping
+   // cursors back to the start of whatever now covers them keeps them valid.
+   u32 OPEIndex = ChunkRegion->StartIndex + ChunkRegion->Count;
+   u32 Cursor = ChunkAllocator->CompactCursor;
+   if ((ChunkRegion->StartIndex < Cursor) && (Cursor < OPEIndex))
+   {
+      ChunkAllocator->CompactCursor = ChunkRegion->StartIndex;
+   }
+
+#if CHUNK_ALLOCATOR_STATS
+   Cursor = ChunkAllocator->Stats.ValidateCursor;
+   if ((ChunkRegion->StartIndex < Cursor) && (Cursor < OPEIndex))
+   {
+      ChunkAllocator->Stats.ValidateCursor = ChunkRegion->StartIndex;
+   }
+#endif
+}
+
+// NOTE (MJP): Gives the first LeadCount chunks of Region, which is out of
+// the bins, back as a free region of their own. The caller sets Region's
+// boundaries.
+function void
+SplitOffLeadingFreeRegion(chunk_allocator *ChunkAllocator, chunk_region *Region, u32 LeadCount)
+{
+   Assert(LeadCount && (LeadCount < Region->Count));
+   chunk_region *LeadRegion = NewChunkRegion(ChunkAllocator, Region->StartIndex, LeadCount);
+   LeadRegion->IsFree = true;
+   SetRegionBoundaries(ChunkAllocator, LeadRegion);
+   InsertFreeRegion(ChunkAllocator, LeadRegion);
+   Region->StartIndex += LeadCount;
+   Region->Count -= LeadCount;
+}
+
+function chunk_region *
+GetLeftNeighbor(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   chunk_region *Neighbor = 0;
+   if (ChunkRegion->StartIndex > 0)
+   {
+      Neighbor =
+         GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[ChunkRegion->StartIndex - 1]);
+   }
+   return(Neighbor);
+}
+
+function chunk_region *
+GetRightNeighbor(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   chunk_region *Neighbor = 0;
+   u32 OPEIndex = ChunkRegion->StartIndex + ChunkRegion->Count;
+   if (OPEIndex < ChunkAllocator->ChunkCount)
+   {
+      Neighbor = GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[OPEIndex]);
+   }
+   return(Neighbor);
+}
+
+function void *
+GetMemoryAddress(chunk_allocator *Allocator, u32 ChunkIndex)
+{
+   void *Address =
+      (void *) (Allocator->ChunkMemory +
+       GetSizeBytes(Allocator, ChunkIndex));
+   Assert(Address);
+   return(Address);
+}
+
+function void *
+GetMemoryAddress(chunk_allocator *Allocator, chunk_region *ChunkRegion)
+{
+   void *Address =
+      (void *) (Allocator->ChunkMemory +
+       GetSizeBytes(Allocator, ChunkRegion->StartIndex));
+   Assert(Address);
+   return(Address);
+}
+
+// NOTE (MJP): Returns NULL_INDEX_U32 for addresses outside chunk memory
+// (including the null allocation).
+function u32
+GetChunkIndex(chunk_allocator *ChunkAllocator, void *Address)
+{
+   u32 ChunkIndex = NULL_INDEX_U32;
+
+   memory_index ChunkMemoryStart = (memory_index)ChunkAllocator->ChunkMemory;
+   memory_index ChunkMemoryEnd = 
+      ChunkMemoryStart + GetSizeBytes(ChunkAllocator, ChunkAllocator->ChunkCount);
+
+   if (((memory_index)Address >= ChunkMemoryStart) &&
+       ((memory_index)Address < ChunkMemoryEnd))
+   {
+      ChunkIndex = 
+         (u32)(((memory_index)Address - ChunkMemoryStart) >>
+               ChunkAllocator->ChunkSizeLog2);
+   }
+
+   return(ChunkIndex);
+}
+
+function chunk_region *
+GetAllocatedRegion(chunk_allocator *ChunkAllocator, u32 ChunkStartIndex)
+{
+   chunk_region *FoundAllocatedRegion = 0;
+
+   if (ChunkStartIndex < ChunkAllocator->ChunkCount)
+   {
+      // NOTE (MJP): The last chunk of a region also points to it, so check
+      // we actually landed on the start of an allocated region.
+      chunk_region *Region =
+         GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[ChunkStartIndex]);
+      if (Region && !Region->IsFree && (Region->StartIndex == ChunkStartIndex))
+      {
+         FoundAllocatedRegion = Region;
+      }
+   }
+
+   return(FoundAllocatedRegion);
+}
+
+function chunk_region *
+GetAllocatedRegion(chunk_allocator *ChunkAllocator, void *RegionStartAddress)
+{
+   chunk_region *FoundAllocatedRegion =
+      GetAllocatedRegion(ChunkAllocator, GetChunkIndex(ChunkAllocator, RegionStartAddress));
+   Assert(!FoundAllocatedRegion ||
+          (GetMemoryAddress(ChunkAllocator, FoundAllocatedRegion) == RegionStartAddress));
+   return(FoundAllocatedRegion);
+}
+
+// NOTE (MJP): MEMORY_FLAG_ values for chunk allocator flags.
+function u32
+GetMemoryFlags(u32 ChunkAllocatorFlags)
+{
+   u32 MemoryFlags = 0;
+   if (GetFlag(ChunkAllocatorFlags, CHUNK_ALLOCATOR_FLAG_HUGE_PAGES))
+   {
+      MemoryFlags |= MEMORY_FLAG_HUGE_PAGES;
+   }
+   if (GetFlag(ChunkAllocatorFlags, CHUNK_ALLOCATOR_FLAG_PREFAULT))
+   {
+      MemoryFlags |= MEMORY_FLAG_PREFAULT;
+   }
+   if (GetFlag(ChunkAllocatorFlags, CHUNK_ALLOCATOR_FLAG_LOCK_MEMORY))
+   {
+      MemoryFlags |= MEMORY_FLAG_LOCK;
+   }
+   return(MemoryFlags);
+}
+
+// NOTE (MJP): Granularity chunk memory is committed and decommitted in.
+function memory_index
+GetCommitSize(u32 ChunkAllocatorFlags)
+{
+   memory_index CommitSize = GetFlag(ChunkAllocatorFlags, CHUNK_ALLOCATOR_FLAG_HUGE_PAGES) ?
+      HUGE_PAGE_SIZE : CHUNK_ALLOCATOR_COMMIT_SIZE;
+   return(CommitSize);
+}
+
+// NOTE (MJP): Makes sure chunk memory is committed up to (not including)
+// OPEChunkIndex. Always succeeds if memory isn't committed on demand.
+function b32
+CommitChunks(chunk_allocator *ChunkAllocator, u32 OPEChunkIndex)
+{
+   b32 Committed = true;
+   if (GetFlag(ChunkAllocator->Flags, CHUNK_ALLOCATOR_FLAG_COMMIT_ON_DEMAND))
+   {
+      memory_index RequiredSize = GetSizeBytes(ChunkAllocator, OPEChunkIndex);
+      if (RequiredSize > ChunkAllocator->CommittedSize)
+      {
+         memory_index ReservedSize =
+            ChunkAllocator->Layout.Size - ChunkAllocator->Layout.ChunkMemoryOffset;
+         memory_index NewCommittedSize =
+            Min(AlignPow2(RequiredSize, GetCommitSize(ChunkAllocator->Flags)),
+                ReservedSize);
+         Committed =
+            CommitMemory(ChunkAllocator->ChunkMemory + ChunkAllocator->CommittedSize,
+                         NewCommittedSize - ChunkAllocator->CommittedSize,
+                         GetMemoryFlags(ChunkAllocator->Flags));
+         if (Committed)
+         {
+            ChunkAllocator->CommittedSize = NewCommittedSize;
+         }
+      }
+   }
+   return(Committed);
+}
+
+// NOTE (MJP): Called with the free region at the end of chunk memory, gives
+// back the committed memory it covers.
+function void
+DecommitFreeTail(chunk_allocator *ChunkAllocator, chunk_region *FreeRegion)
+{
+   if (GetFlag(ChunkAllocator->Flags, CHUNK_ALLOCATOR_FLAG_DECOMMIT_FREE_TAIL) &&
+       ((FreeRegion->StartIndex + FreeRegion->Count) == ChunkAllocator->ChunkCount))
+   {
+      memory_index NewCommittedSize =
+         AlignPow2(GetSizeBytes(ChunkAllocator, FreeRegion->StartIndex),
+                   GetCommitSize(ChunkAllocator->Flags));
+      if ((NewCommittedSize < ChunkAllocator->CommittedSize) &&
+          ((ChunkAllocator->CommittedSize - NewCommittedSize) >= (memory_index)CHUNK_ALLOCATOR_DECOMMIT_THRESHOLD))
+      {
+         DecommitMemory(ChunkAllocator->ChunkMemory + NewCommittedSize,
+                        ChunkAllocator->CommittedSize - NewCommittedSize,
+                        GetMemoryFlags(ChunkAllocator->Flags));
+         ChunkAllocator->CommittedSize = NewCommittedSize;
+      }
+   }
+}
+
+// NOTE (MJP): Takes a region that has just been marked free (and isn't in any
+// list), absorbs any free neighbors into it and returns it.
+function chunk_region *
+MergeNeighboringFreeRegions(chunk_allocator *ChunkAllocator, chunk_region *FreeRegion)
+{
+   Assert(FreeRegion->IsFree);
+
+   chunk_region *LeftRegion = GetLeftNeighbor(ChunkAllocator, FreeRegion);
+   if (LeftRegion && LeftRegion->IsFree)
+   {
+      FreeRegion->StartIndex = LeftRegion->StartIndex;
+      FreeRegion->Count += LeftRegion->Count;
+      RemoveChunkRegion(ChunkAllocator, LeftRegion);
+   }
+
+   chunk_region *RightRegion = GetRightNeighbor(ChunkAllocator, FreeRegion);
+   if (RightRegion && RightRegion->IsFree)
+   {
+      FreeRegion->Count += RightRegion->Count;
+      RemoveChunkRegion(ChunkAllocator, RightRegion);
+   }
+
+   SetRegionBoundaries(ChunkAllocator, FreeRegion);
+   return(FreeRegion);
+}
+
+function void
+FreeChunkRegion(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion)
+{
+   Assert(!ChunkRegion->IsFree);
+   ChunkStat(ChunkAllocator->Stats.AllocatedChunkCount -= ChunkRegion->Count);
+   ChunkStat(--ChunkAllocator->Stats.AllocationCount);
+   ChunkStat(++ChunkAllocator->Stats.FreeCount);
+
+   PoisonChunks(GetMemoryAddress(ChunkAllocator, ChunkRegion),
+                GetSizeBytes(ChunkAllocator, ChunkRegion->Count));
+
+   RegionListRemove(ChunkAllocator, ChunkRegion);
+   ChunkRegion->IsFree = true;
+   ChunkRegion->IsRelocatable = false;
+   ChunkRegion = MergeNeighboringFreeRegions(ChunkAllocator, ChunkRegion);
+   InsertFreeRegion(ChunkAllocator, ChunkRegion);
+   DecommitFreeTail(ChunkAllocator, ChunkRegion);
+}
+
+// NOTE (MJP): Grows or shrinks an allocated region without moving it, using the
+// free region to its right. Returns false if there isn't enough space.
+function b32
+ResizeChunkRegionInPlace(chunk_allocator *ChunkAllocator, chunk_region *ChunkRegion, u32 ChunkCount)
+{
+   Assert(!ChunkRegion->IsFree);
+   Assert(ChunkCount);
+
+   b32 Resized = false;
+   chunk_region *RightRegion = GetRightNeighbor(ChunkAllocator, ChunkRegion);
+
+   if (ChunkCount < ChunkRegion->Count)
+   {
+      u32 ReleasedChunks = ChunkRegion->Count - ChunkCount;
+      ChunkStat(ChunkAllocator->Stats.AllocatedChunkCount -= ReleasedChunks);
+      PoisonChunks(GetMemoryAddress(ChunkAllocator, ChunkRegion->StartIndex + ChunkCount),
+                   GetSizeBytes(ChunkAllocator, ReleasedChunks));
+      ChunkRegion->Count = ChunkCount;
+      SetRegionBoundaries(ChunkAllocator, ChunkRegion);
+
+      if (RightRegion && RightRegion->IsFree)
+      {
+         // NOTE (MJP): Count changes, so it has to move bins.
+         RemoveFreeRegion(ChunkAllocator, RightRegion);
+         RightRegion->StartIndex -= ReleasedChunks;
+         RightRegion->Count += ReleasedChunks;
+         SetRegionBoundaries(ChunkAllocator, RightRegion);
+         InsertFreeRegion(ChunkAllocator, RightRegion);
+         DecommitFreeTail(ChunkAllocator, RightRegion);
+      }
+      else
+      {
+         chunk_region *NewFreeRegion =
+            NewChunkRegion(ChunkAllocator, ChunkRegion->StartIndex + ChunkCount, ReleasedChunks);
+         NewFreeRegion->IsFree = true;
+         SetRegionBoundaries(ChunkAllocator, NewFreeRegion);
+         InsertFreeRegion(ChunkAllocator, NewFreeRegion);
+         DecommitFreeTail(ChunkAllocator, NewFreeRegion);
+      }
+      Resized = true;
+   }
+   else if (ChunkCount > ChunkRegion->Count)
+   {
+      u32 RequiredChunks = ChunkCount - ChunkRegion->Count;
+      if (RightRegion && RightRegion->IsFree &&
+          (RightRegion->Count >= RequiredChunks) &&
+          CommitChunks(ChunkAllocator, ChunkRegion->StartIndex + ChunkCount))
+      {
+         if (RightRegion->Count == RequiredChunks)
+         {
+            RemoveChunkRegion(ChunkAllocator, RightRegion);
+         }
+         else
+         {
+            RemoveFreeRegion(ChunkAllocator, RightRegion);
+            RightRegion->StartIndex += RequiredChunks;
+            RightRegion->Count -= RequiredChunks;
+            SetRegionBoundaries(ChunkAllocator, RightRegion);
+            InsertFreeRegion(ChunkAllocator, RightRegion);
+         }
+
+         ChunkStat(ChunkAllocator->Stats.AllocatedChunkCount += RequiredChunks);
+         ChunkRegion->Count = ChunkCount;
+         SetRegionBoundaries(ChunkAllocator, ChunkRegion);
+         Resized = true;
+      }
+   }
+   else
+   {
+      Resized = true;
+   }
+
+   return(Resized);
+}
+
+function chunk_allocator_params
+DefaultChunkAllocatorParams()
+{
+   chunk_allocator_params Params = {};
+   Params.ChunkSize = CHUNK_ALLOCATOR_CHUNK_SIZE;
+   Params.ChunkCount = CHUNK_ALLOCATOR_CHUNK_COUNT;
+   Params.Alignment = CHUNK_ALLOCATOR_ALIGNMENT;
+   return(Params);
+}
+
+// NOTE (MJP): What SetupAllocator needs of its params. LoadAllocator checks
+// saved ones with this rather than asserting, as they come from a file.
+inline b32
+IsValidChunkAllocatorParams(chunk_allocator_params Params)
+{
+   b32 Result = (Params.ChunkSize && !(Params.ChunkSize & (Params.ChunkSize - 1)) &&
+                 Params.Alignment && !(Params.Alignment & (Params.Alignment - 1)) &&
+                 // NOTE (MJP): mmap is page aligned, which covers any
+                 // Alignment up to a page.
+                 (Params.Alignment <= SYSTEM_PAGE_SIZE) &&
+                 Params.ChunkCount);
+   return(Result);
+}
+
+// NOTE (MJP): The region pool has room for one region per chunk, as there can
+// never be more live regions than that, and recycled ones are reused first.
+// Chunk memory starts on a page so it can be committed on demand.
+function chunk_heap_layout
+GetChunkHeapLayout(chunk_allocator_params Params)
+{
+   chunk_heap_layout Layout = {};
+
+   memory_index RegionCapacity = CHUNK_REGION_FIRST_NODE + (memory_index)Params.ChunkCount;
+   memory_index ChunkMemorySize = (memory_index)Params.ChunkSize*Params.ChunkCount;
+
+   Layout.RegionsOffset = AlignPow2(SizeOf(chunk_heap_header), (memory_index)L2_CACHE_SIZE);
+   Layout.RegionTableOffset =
+      AlignPow2(Layout.RegionsOffset + SizeOf(chunk_region)*RegionCapacity,
+                (memory_index)L2_CACHE_SIZE);
+   memory_index ChunkMemoryAlignment =
+      GetFlag(Params.Flags, CHUNK_ALLOCATOR_FLAG_HUGE_PAGES) ? HUGE_PAGE_SIZE : SYSTEM_PAGE_SIZE;
+   Layout.ChunkMemoryOffset =
+      AlignPow2(Layout.RegionTableOffset + SizeOf(u32)*(memory_index)Params.ChunkCount,
+                ChunkMemoryAlignment);
+   Layout.Size =
+      AlignPow2(Layout.ChunkMemoryOffset + ChunkMemorySize, (memory_index)SYSTEM_PAGE_SIZE);
+
+   return(Layout);
+}
+
+function void
+SetHeapPointers(chunk_allocator *ChunkAllocator)
+{
+   ChunkAllocator->Regions =
+      (chunk_region *)(ChunkAllocator->Base + ChunkAllocator->Layout.RegionsOffset);
+   ChunkAllocator->RegionTable =
+      (u32 *)(ChunkAllocator->Base + ChunkAllocator->Layout.RegionTableOffset);
+   ChunkAllocator->ChunkMemory =
+      ChunkAllocator->Base + ChunkAllocator->Layout.ChunkMemoryOffset;
+}
+
+// NOTE (MJP): Returns false, leaving ChunkAllocator zeroed, if the heap
+// block can't be reserved.
+function b32
+SetupAllocator(chunk_allocator *ChunkAllocator, chunk_allocator_params Params)
+{
+   AssertPrint(IsValidChunkAllocatorParams(Params),
+               "SetupAllocator: bad ChunkSize, Alignment or ChunkCount");
+
+   ZeroStruct(*ChunkAllocator);
+   ChunkAllocator->ChunkSize = Params.ChunkSize;
+   ChunkAllocator->ChunkSizeLog2 = FindMostSignificantSetBit(Params.ChunkSize).Index;
+   ChunkAllocator->ChunkCount = Params.ChunkCount;
+   ChunkAllocator->Alignment = Params.Alignment;
+   ChunkAllocator->Flags = Params.Flags;
+
+   ChunkAllocator->Layout = GetChunkHeapLayout(Params);
+   u32 MemoryFlags = GetMemoryFlags(ChunkAllocator->Flags);
+   ChunkAllocator->Base = (u8 *)ReserveMemory(ChunkAllocator->Layout.Size, MemoryFlags);
+   b32 Result = false;
+   if (ChunkAllocator->Base)
+   {
+      // NOTE (MJP): Metadata is only backed by physical pages once it's
+      // written, and fresh pages are already zero.
+      CommitMemory(ChunkAllocator->Base, ChunkAllocator->Layout.ChunkMemoryOffset, MemoryFlags);
+      SetHeapPointers(ChunkAllocator);
+
+      ChunkAllocator->CommittedSize = 0;
+      if (!GetFlag(ChunkAllocator->Flags, CHUNK_ALLOCATOR_FLAG_COMMIT_ON_DEMAND))
+      {
+         ChunkAllocator->CommittedSize =
+            ChunkAllocator->Layout.Size - ChunkAllocator->Layout.ChunkMemoryOffset;
+         CommitMemory(ChunkAllocator->ChunkMemory, ChunkAllocator->CommittedSize, MemoryFlags);
+      }
+
+      RegionListInit(ChunkAllocator, CHUNK_REGION_ALLOCATED_SENTINEL);
+      RegionListInit(ChunkAllocator, CHUNK_REGION_FREE_LIST_SENTINEL);
+      for (u32 BinIndex = 0; BinIndex < CHUNK_ALLOCATOR_BIN_COUNT; ++BinIndex)
+      {
+         RegionListInit(ChunkAllocator, CHUNK_REGION_FIRST_BIN_SENTINEL + BinIndex);
+      }
+      ChunkAllocator->RegionCount = CHUNK_REGION_FIRST_NODE;
+
+      // Setup the first free region
+      chunk_region *FreeRegion =
+         NewChunkRegion(ChunkAllocator, 0, ChunkAllocator->ChunkCount);
+      FreeRegion->IsFree = true;
+      SetRegionBoundaries(ChunkAllocator, FreeRegion);
+      InsertFreeRegion(ChunkAllocator, FreeRegion);
+
+      Result = true;
+   }
+   else
+   {
+      ZeroStruct(*ChunkAllocator);
+   }
+
+   return(Result);
+}
+
+function b32
+SetupAllocator(chunk_allocator *ChunkAllocator)
+{
+   b32 Result = SetupAllocator(ChunkAllocator, DefaultChunkAllocatorParams());
+   return(Result);
+}
+
+function void
+ReleaseAllocator(chunk_allocator *ChunkAllocator)
+{
+   if (ChunkAllocator->Base)
+   {
+      ReleaseMemory(ChunkAllocator->Base, ChunkAllocator->Layout.Size);
+   }
+   ZeroStruct(*ChunkAllocator);
+}
+
+// NOTE (MJP): Walks every region through the boundary tags, so regions must
+// tile the chunk memory exactly, with no overlaps or gaps.
+function void
+CheckForClashingRegions(chunk_allocator *ChunkAllocator)
+{
+   u32 AllocatedRegionCount = 0;
+   for (u32 RegionIndex = ChunkAllocator->Regions[CHUNK_REGION_ALLOCATED_SENTINEL].Next;
+            RegionIndex != CHUNK_REGION_ALLOCATED_SENTINEL;
+            RegionIndex = ChunkAllocator->Regions[RegionIndex].Next)
+   {
+      Assert(!ChunkAllocator->Regions[RegionIndex].IsFree);
+      ++AllocatedRegionCount;
+   }
+
+   u32 FreeRegionCount = 0;
+   for (u32 BinIndex = 0; BinIndex < CHUNK_ALLOCATOR_BIN_COUNT; ++BinIndex)
+   {
+      u32 SentinelIndex = CHUNK_REGION_FIRST_BIN_SENTINEL + BinIndex;
+      for (u32 RegionIndex = ChunkAllocator->Regions[SentinelIndex].Next;
+               RegionIndex != SentinelIndex;
+               RegionIndex = ChunkAllocator->Regions[RegionIndex].Next)
+      {
+         Assert(ChunkAllocator->Regions[RegionIndex].IsFree);
+         Assert(GetFreeBinSentinel(GetBinIndexForInsert(ChunkAllocator->Regions[RegionIndex].Count)) ==
+                SentinelIndex);
+         ++FreeRegionCount;
+      }
+   }
+
+   u32 WalkedRegionCount = 0;
+#if ASSERTS_ENABLED
+   b32 PrevIsFree = false;
+#endif
+   for (u32 ChunkIndex = 0; ChunkIndex < ChunkAllocator->ChunkCount;)
+   {
+      chunk_region *Region = GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[ChunkIndex]);
+      Assert(Region);
+      Assert(Region->StartIndex == ChunkIndex);
+      Assert(Region->Count);
+      Assert(ChunkAllocator->RegionTable[Region->StartIndex + Region->Count - 1] ==
+             GetRegionIndex(ChunkAllocator, Region));
+
+#if ASSERTS_ENABLED
+      // NOTE (MJP): Free neighbors should always have been merged.
+      Assert(!(PrevIsFree && Region->IsFree));
+      PrevIsFree = Region->IsFree;
+#endif
+
+      ChunkIndex += Region->Count;
+      Assert(ChunkIndex <= ChunkAllocator->ChunkCount);
+      ++WalkedRegionCount;
+   }
+
+   Assert(WalkedRegionCount == (AllocatedRegionCount + FreeRegionCount));
+}
+
+// NOTE (MJP): Chunk count of the largest free region. Only walks the highest
+// non empty bin.
+function u32
+GetLargestFreeRegionCount(chunk_allocator *ChunkAllocator)
+{
+   u32 LargestCount = 0;
+   bit_scan_result FL = FindMostSignificantSetBit(ChunkAllocator->FLBitmap);
+   if (FL.Found)
+   {
+      chunk_bin_index BinIndex = {};
+      BinIndex.FL = FL.Index;
+      BinIndex.SL = FindMostSignificantSetBit(ChunkAllocator->SLBitmap[FL.Index]).Index;
+
+      u32 SentinelIndex = GetFreeBinSentinel(BinIndex);
+      for (u32 RegionIndex = ChunkAllocator->Regions[SentinelIndex].Next;
+               RegionIndex != SentinelIndex;
+               RegionIndex = ChunkAllocator->Regions[RegionIndex].Next)
+      {
+         LargestCount = Max(LargestCount, ChunkAllocator->Regions[RegionIndex].Count);
+      }
+   }
+   return(LargestCount);
+}
+
+// NOTE (MJP): Prints one character per ChunksPerCell chunks, '.' all free,
+// '#' all allocated and '+' for a mix. 0 picks a size that fits the whole
+// heap in about 32 rows.
+function void
+DumpChunkOccupancy(chunk_allocator *ChunkAllocator, FILE *Stream, u32 ChunksPerCell = 0,
+                   u32 CellsPerRow = 64)
+{
+   if (!ChunksPerCell)
+   {
+      u32 CellCount = CellsPerRow*32;
+      ChunksPerCell = Max(1u, (ChunkAllocator->ChunkCount + CellCount - 1) / CellCount);
+   }
+
+   u32 CellIndex = 0;
+   u32 CellStartIndex = 0;
+   u32 AllocatedInCell = 0;
+   for (u32 ChunkIndex = 0; ChunkIndex < ChunkAllocator->ChunkCount;)
+   {
+      chunk_region *Region = GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[ChunkIndex]);
+      u32 RegionEndIndex = Region->StartIndex + Region->Count;
+
+      // NOTE (MJP): Hand the region out to the cells it covers.
+      while (ChunkIndex < RegionEndIndex)
+      {
+         u32 CellEndIndex = Min(CellStartIndex + ChunksPerCell, ChunkAllocator->ChunkCount);
+         u32 Covered = Min(RegionEndIndex, CellEndIndex) - ChunkIndex;
+         if (!Region->IsFree)
+         {
+            AllocatedInCell += Covered;
+         }
+         ChunkIndex += Covered;
+
+         if (ChunkIndex == CellEndIndex)
+         {
+            u32 CellChunkCount = CellEndIndex - CellStartIndex;
+            char Cell = (AllocatedInCell == 0) ? '.' :
+                        (AllocatedInCell == CellChunkCount) ? '#' : '+';
+            fputc(Cell, Stream);
+            if ((++CellIndex % CellsPerRow) == 0)
+            {
+               fputc('\n', Stream);
+            }
+            CellStartIndex = CellEndIndex;
+            AllocatedInCell = 0;
+         }
+      }
+   }
+   if (CellIndex % CellsPerRow)
+   {
+      fputc('\n', Stream);
+   }
+
+#if CHUNK_ALLOCATOR_STATS
+   chunk_allocator_stats *Stats = &ChunkAllocator->Stats;
+   fprintf(Stream, "in use: %llu bytes, %u allocations, %u free regions, largest free: %llu bytes\n",
+           (unsigned long long)GetSizeBytes(ChunkAllocator, Stats->AllocatedChunkCount),
+           Stats->AllocationCount, Stats->FreeRegionCount,
+           (unsigned long long)GetSizeBytes(ChunkAllocator, GetLargestFreeRegionCount(ChunkAllocator)));
+   fprintf(Stream, "allocs: %llu, frees: %llu, resizes: %llu (%llu in place), copied: %llu bytes\n",
+           (unsigned long long)Stats->AllocateCount, (unsigned long long)Stats->FreeCount,
+           (unsigned long long)Stats->ResizeCount, (unsigned long long)Stats->InPlaceResizeCount,
+           (unsigned long long)Stats->CopyBytes);
+   for (u32 Bucket = 0; Bucket < ArrayCount(Stats->SizeHistogram); ++Bucket)
+   {
+      if (Stats->SizeHistogram[Bucket])
+      {
+         fprintf(Stream, "   [%u, %u): %llu\n", (1u << Bucket), (1u << Bucket) << 1,
+                 (unsigned long long)Stats->SizeHistogram[Bucket]);
+      }
+   }
+#endif
+}
+
+#if CHUNK_ALLOCATOR_STATS
+// NOTE (MJP): Cheaper than CheckForClashingRegions, checks up to RegionBudget
+// regions from where the last call stopped, wrapping around the heap. Each
+// region is checked against its tags, its right neighbor, its list links and
+// (if free) the bin bitmaps.
+function void
+ValidateChunkAllocator(chunk_allocator *ChunkAllocator, u32 RegionBudget)
+{
+   u32 Cursor = ChunkAllocator->Stats.ValidateCursor;
+   for (u32 Step = 0; Step < RegionBudget; ++Step)
+   {
+      u32 RegionIndex = ChunkAllocator->RegionTable[Cursor];
+      chunk_region *Region = GetRegion(ChunkAllocator, RegionIndex);
+      Assert(Region);
+      Assert(Region->StartIndex == Cursor);
+      Assert(Region->Count);
+      u32 EndIndex = Region->StartIndex + Region->Count;
+      Assert(EndIndex <= ChunkAllocator->ChunkCount);
+      Assert(ChunkAllocator->RegionTable[EndIndex - 1] == RegionIndex);
+      Assert(ChunkAllocator->Regions[Region->Next].Prev == RegionIndex);
+      Assert(ChunkAllocator->Regions[Region->Prev].Next == RegionIndex);
+      Assert(Region->IsFree || !GetAlignmentPadding(ChunkAllocator, Region->StartIndex));
+
+#if ASSERTS_ENABLED
+      if (Region->IsFree)
+      {
+         chunk_bin_index BinIndex = GetBinIndexForInsert(Region->Count);
+         Assert(ChunkAllocator->FLBitmap & (1 << BinIndex.FL));
+         Assert(ChunkAllocator->SLBitmap[BinIndex.FL] & (1 << BinIndex.SL));
+
+         chunk_region *RightRegion = GetRightNeighbor(ChunkAllocator, Region);
+         Assert(!RightRegion || !RightRegion->IsFree);
+      }
+#endif
+
+      Cursor = (EndIndex == ChunkAllocator->ChunkCount) ? 0 : EndIndex;
+   }
+   ChunkAllocator->Stats.ValidateCursor = Cursor;
+}
+
+// NOTE (MJP): Recounts the live values from the boundary tags, the running
+// totals start again from zero.
+function void
+RebuildChunkAllocatorStats(chunk_allocator *ChunkAllocator)
+{
+   ZeroStruct(ChunkAllocator->Stats);
+   for (u32 ChunkIndex = 0; ChunkIndex < ChunkAllocator->ChunkCount;)
+   {
+      chunk_region *Region = GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[ChunkIndex]);
+      if (Region->IsFree)
+      {
+         ++ChunkAllocator->Stats.FreeRegionCount;
+      }
+      else
+      {
+         ChunkAllocator->Stats.AllocatedChunkCount += Region->Count;
+         ++ChunkAllocator->Stats.AllocationCount;
+      }
+      ChunkIndex += Region->Count;
+   }
+}
+#endif
+
+function chunk_region *
+AllocateChunkRegion(chunk_allocator *ChunkAllocator, u32 ChunkCount)
+{
+   Assert(ChunkCount);
+   Assert(ChunkAllocator->ChunkMemory);
+
+   // NOTE (MJP): With Alignment above ChunkSize the search asks for enough
+   // extra chunks to reach an aligned start anywhere in the region, and the
+   // chunks before that start go back as a free region of their own.
+   u64 SearchCount = (u64)ChunkCount + GetAlignmentChunkCount(ChunkAllocator) - 1;
+   chunk_region *AllocatedRegion = 0;
+   if (SearchCount <= ChunkAllocator->ChunkCount)
+   {
+      AllocatedRegion = FindFreeRegion(ChunkAllocator, (u32)SearchCount);
+   }
+
+   u32 LeadCount = 0;
+   if (AllocatedRegion)
+   {
+      LeadCount = GetAlignmentPadding(ChunkAllocator, AllocatedRegion->StartIndex);
+      if (!CommitChunks(ChunkAllocator, AllocatedRegion->StartIndex + LeadCount + ChunkCount))
+      {
+         InsertFreeRegion(ChunkAllocator, AllocatedRegion);
+         AllocatedRegion = 0;
+      }
+   }
+
+   if (AllocatedRegion)
+   {
+      if (LeadCount)
+      {
+         SplitOffLeadingFreeRegion(ChunkAllocator, AllocatedRegion, LeadCount);
+      }
+
+      // NOTE (MJP): Allocated regions are looked up through the table, so
+      // the list doesn't need to be kept in order.
+      RegionListInsertBefore(ChunkAllocator, CHUNK_REGION_ALLOCATED_SENTINEL, AllocatedRegion);
+      AllocatedRegion->IsFree = false;
+      AllocatedRegion->IsRelocatable = false;
+
+      u32 RemainingChunks = AllocatedRegion->Count - ChunkCount;
+      if (RemainingChunks)
+      {
+         u32 NewFreeRegionStartIndex = 
+               (AllocatedRegion->StartIndex + ChunkCount);
+         chunk_region *NewFreeRegion =
+            NewChunkRegion(ChunkAllocator, NewFreeRegionStartIndex, RemainingChunks);
+         Assert(NewFreeRegion->StartIndex != AllocatedRegion->StartIndex);
+         NewFreeRegion->IsFree = true;
+         SetRegionBoundaries(ChunkAllocator, NewFreeRegion);
+         InsertFreeRegion(ChunkAllocator, NewFreeRegion);
+      }
+
+      AllocatedRegion->Count = ChunkCount;
+      SetRegionBoundaries(ChunkAllocator, AllocatedRegion);
+
+      ChunkStat(ChunkAllocator->Stats.AllocatedChunkCount += ChunkCount);
+      ChunkStat(++ChunkAllocator->Stats.AllocationCount);
+      ChunkStat(++ChunkAllocator->Stats.AllocateCount);
+   }
+
+   return(AllocatedRegion);
+}
+
+// NOTE (mjp): Return an index to be used for relative pointers. Allocations are
+// identified by their start chunk index, NULL_INDEX_U32 being no allocation.
+// When there's no room it returns NULL_INDEX_U32 and leaves the source
+// allocation as it was.
+function u32
+ResizeAllocationIndex(chunk_allocator *ChunkAllocator, u32 RegionStartIndex, u32 SizeBytes)
+{
+   chunk_region *SourceRegion =
+      GetAllocatedRegion(ChunkAllocator, RegionStartIndex);
+
+   Assert(ChunkAllocator->ChunkMemory);
+   u32 NewRegionStartIndex = NULL_INDEX_U32;
+   u32 NewChunkCount = GetChunkCount(ChunkAllocator, SizeBytes);
+
+   if (NewChunkCount)
+   {
+      ChunkStat(++ChunkAllocator->Stats.SizeHistogram[FindMostSignificantSetBit(SizeBytes).Index]);
+      ChunkStat(ChunkAllocator->Stats.ResizeCount += (SourceRegion != 0));
+
+      if (SourceRegion &&
+          ResizeChunkRegionInPlace(ChunkAllocator, SourceRegion, NewChunkCount))
+      {
+         NewRegionStartIndex = SourceRegion->StartIndex;
+         ChunkStat(++ChunkAllocator->Stats.InPlaceResizeCount);
+      }
+      else
+      {
+         chunk_region *DestRegion =
+            AllocateChunkRegion(ChunkAllocator, NewChunkCount);
+
+         if (DestRegion)
+         {
+            if (SourceRegion)
+            {
+               // Copy and free
+               void *SourceMemory =
+                  GetMemoryAddress(ChunkAllocator, SourceRegion);
+               void *DestMemory =
+                  GetMemoryAddress(ChunkAllocator, DestRegion);
+
+               memory_index CopySizeBytes =
+                  GetSizeBytes(ChunkAllocator, Min(SourceRegion->Count, DestRegion->Count));
+               Assert(CopySizeBytes <= GetSizeBytes(ChunkAllocator, DestRegion->Count));
+               MemCopy(DestMemory, SourceMemory, CopySizeBytes);
+               ChunkStat(ChunkAllocator->Stats.CopyBytes += CopySizeBytes);
+
+               FreeChunkRegion(ChunkAllocator, SourceRegion);
+            }
+
+            NewRegionStartIndex = DestRegion->StartIndex;
+         }
+      }
+   }
+   else
+   {
+      if (SourceRegion)
+      {
+         FreeChunkRegion(ChunkAllocator, SourceRegion);
+      }
+      NewRegionStartIndex = NULL_INDEX_U32;
+   }
+
+   // CheckForClashingRegions(ChunkAllocator);
+   return(NewRegionStartIndex);
+}
+
+function void *
+ResizeAllocationVoid(chunk_allocator *ChunkAllocator, void *RegionStartAddress, u32 SizeBytes)
+{
+   u32 RegionStartIndex = GetChunkIndex(ChunkAllocator, RegionStartAddress);
+   Assert((RegionStartIndex == NULL_INDEX_U32) ||
+          GetAllocatedRegion(ChunkAllocator, RegionStartAddress));
+
+   u32 NewRegionStartIndex =
+      ResizeAllocationIndex(ChunkAllocator, RegionStartIndex, SizeBytes);
+
+   void *NewRegionStartAddress = 0x0;
+   if (NewRegionStartIndex != NULL_INDEX_U32)
+   {
+      NewRegionStartAddress = GetMemoryAddress(ChunkAllocator, NewRegionStartIndex);
+   }
+
+   return(NewRegionStartAddress);
+}
+
+// NOTE (MJP): Constant time, the region is found through the boundary tags
+// and merged with its neighbors. Freeing the null allocation does nothing.
+function void
+FreeAllocationIndex(chunk_allocator *ChunkAllocator, u32 RegionStartIndex)
+{
+   if (RegionStartIndex != NULL_INDEX_U32)
+   {
+      chunk_region *Region = GetAllocatedRegion(ChunkAllocator, RegionStartIndex);
+      AssertPrint(Region, "FreeAllocation: double free, or not the start of an allocation");
+      if (Region)
+      {
+         FreeChunkRegion(ChunkAllocator, Region);
+      }
+   }
+}
+
+function void
+FreeAllocationVoid(chunk_allocator *ChunkAllocator, void *RegionStartAddress)
+{
+   if (RegionStartAddress)
+   {
+      u32 RegionStartIndex = GetChunkIndex(ChunkAllocator, RegionStartAddress);
+      AssertPrint((RegionStartIndex != NULL_INDEX_U32) &&
+                  (GetMemoryAddress(ChunkAllocator, RegionStartIndex) == RegionStartAddress),
+                  "FreeAllocation: pointer not from this allocator");
+      FreeAllocationIndex(ChunkAllocator, RegionStartIndex);
+   }
+}
+
+//
+// Handles and compaction
+//
+// Allocations made through a handle may be moved by CompactAllocator, which
+// slides them down into the free space to their left. The handle is the index
+// of the allocation's region node, which stays with the allocation when it
+// moves or is resized, so it never changes. Pointers from GetHandlePointer
+// are only good until the next compaction or resize. Pointer and index
+// allocations never move, compaction steps over them.
+//
+
+typedef u32 chunk_handle;
+#define NULL_CHUNK_HANDLE CHUNK_REGION_NULL
+
+function chunk_region *
+GetHandleRegion(chunk_allocator *ChunkAllocator, chunk_handle Handle)
+{
+   chunk_region *Region = GetRegion(ChunkAllocator, Handle);
+   Assert(!Region ||
+          ((Handle >= CHUNK_REGION_FIRST_NODE) && !Region->IsFree && Region->IsRelocatable));
+   return(Region);
+}
+
+function void *
+GetHandlePointer(chunk_allocator *ChunkAllocator, chunk_handle Handle)
+{
+   void *Pointer = 0;
+   chunk_region *Region = GetHandleRegion(ChunkAllocator, Handle);
+   if (Region)
+   {
+      Pointer = GetMemoryAddress(ChunkAllocator, Region);
+   }
+   return(Pointer);
+}
+
+// NOTE (MJP): Same semantics as ResizeAllocationIndex, except the handle
+// survives a moving resize: the region nodes are swapped so the handle's node
+// describes the new chunks.
+function chunk_handle
+ResizeHandleAllocation(chunk_allocator *ChunkAllocator, chunk_handle Handle, u32 SizeBytes)
+{
+   chunk_region *SourceRegion = GetHandleRegion(ChunkAllocator, Handle);
+   u32 NewChunkCount = GetChunkCount(ChunkAllocator, SizeBytes);
+
+   chunk_handle NewHandle = NULL_CHUNK_HANDLE;
+   if (!NewChunkCount)
+   {
+      if (SourceRegion)
+      {
+         FreeChunkRegion(ChunkAllocator, SourceRegion);
+      }
+   }
+   else if (!SourceRegion)
+   {
+      chunk_region *Region = AllocateChunkRegion(ChunkAllocator, NewChunkCount);
+      if (Region)
+      {
+         Region->IsRelocatable = true;
+         NewHandle = GetRegionIndex(ChunkAllocator, Region);
+      }
+   }
+   else if (ResizeChunkRegionInPlace(ChunkAllocator, SourceRegion, NewChunkCount))
+   {
+      NewHandle = Handle;
+   }
+   else
+   {
+      chunk_region *DestRegion = AllocateChunkRegion(ChunkAllocator, NewChunkCount);
+      if (DestRegion)
+      {
+         u32 CopyChunkCount = Min(SourceRegion->Count, DestRegion->Count);
+         MemCopy(GetMemoryAddress(ChunkAllocator, DestRegion),
+                 GetMemoryAddress(ChunkAllocator, SourceRegion),
+                 (u32)GetSizeBytes(ChunkAllocator, CopyChunkCount));
+         ChunkStat(ChunkAllocator->Stats.CopyBytes += GetSizeBytes(ChunkAllocator, CopyChunkCount));
+
+         u32 OldStartIndex = SourceRegion->StartIndex;
+         u32 OldCount = SourceRegion->Count;
+         SourceRegion->StartIndex = DestRegion->StartIndex;
+         SourceRegion->Count = DestRegion->Count;
+         DestRegion->StartIndex = OldStartIndex;
+         DestRegion->Count = OldCount;
+         SetRegionBoundaries(ChunkAllocator, SourceRegion);
+         SetRegionBoundaries(ChunkAllocator, DestRegion);
+
+         FreeChunkRegion(ChunkAllocator, DestRegion);
+         NewHandle = Handle;
+      }
+   }
+
+   return(NewHandle);
+}
+
+inline void
+FreeHandleAllocation(chunk_allocator *ChunkAllocator, chunk_handle Handle)
+{
+   ResizeHandleAllocation(ChunkAllocator, Handle, 0);
+}
+
+#define NewHandleAllocation(Allocator, Type, Count) ResizeHandleAllocation((Allocator), NULL_CHUNK_HANDLE, SizeOf(Type)*(Count))
+#define GetHandleAllocation(Allocator, Handle, Type) ((Type *)GetHandlePointer((Allocator), (Handle)))
+
+// NOTE (MJP): Slides relocatable allocations down into the free region to
+// their left. Work per call is bounded by ChunkBudget: each chunk moved costs
+// one, and so does each region stepped over (a call always gets at least one
+// allocation moved, so big ones still make progress). Picks up where the last
+// call stopped. Returns true when it reaches the end of the heap, the next
+// call starts over from the bottom.
+function b32
+CompactAllocator(chunk_allocator *ChunkAllocator, u32 ChunkBudget)
+{
+   b32 FinishedPass = false;
+   u32 Work = 0;
+   u32 Cursor = ChunkAllocator->CompactCursor;
+
+   for (;;)
+   {
+      if (Cursor >= ChunkAllocator->ChunkCount)
+      {
+         Cursor = 0;
+         FinishedPass = true;
+         break;
+      }
+
+      chunk_region *Region = GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[Cursor]);
+      Assert(Region && (Region->StartIndex == Cursor));
+
+      chunk_region *RightRegion = GetRightNeighbor(ChunkAllocator, Region);
+      // NOTE (MJP): The allocation can only land on an aligned start, which
+      // may leave a few free chunks in front of it.
+      u32 LeadCount = GetAlignmentPadding(ChunkAllocator, Region->StartIndex);
+      if (Region->IsFree && RightRegion && RightRegion->IsRelocatable &&
+          (LeadCount < Region->Count))
+      {
+         if (Work && ((Work + RightRegion->Count) > ChunkBudget))
+         {
+            break;
+         }
+
+         // NOTE (MJP): Swap the free region and the allocation, the free
+         // region may then merge with whatever follows.
+         chunk_region *FreeRegion = Region;
+         RemoveFreeRegion(ChunkAllocator, FreeRegion);
+         if (LeadCount)
+         {
+            SplitOffLeadingFreeRegion(ChunkAllocator, FreeRegion, LeadCount);
+         }
+
+         u32 FreeStartIndex = FreeRegion->StartIndex;
+         memmove(GetMemoryAddress(ChunkAllocator, FreeStartIndex),
+                 GetMemoryAddress(ChunkAllocator, RightRegion),
+                 GetSizeBytes(ChunkAllocator, RightRegion->Count));
+         ChunkStat(ChunkAllocator->Stats.CopyBytes += GetSizeBytes(ChunkAllocator, RightRegion->Count));
+
+         RightRegion->StartIndex = FreeStartIndex;
+         SetRegionBoundaries(ChunkAllocator, RightRegion);
+         FreeRegion->StartIndex = FreeStartIndex + RightRegion->Count;
+         SetRegionBoundaries(ChunkAllocator, FreeRegion);
+
+         FreeRegion = MergeNeighboringFreeRegions(ChunkAllocator, FreeRegion);
+         InsertFreeRegion(ChunkAllocator, FreeRegion);
+         DecommitFreeTail(ChunkAllocator, FreeRegion);
+
+         Work += RightRegion->Count;
+         Cursor = FreeRegion->StartIndex;
+      }
+      else
+      {
+         if (Work >= ChunkBudget)
+         {
+            break;
+         }
+         ++Work;
+         Cursor += Region->Count;
+      }
+   }
+
+   ChunkAllocator->CompactCursor = Cursor;
+   return(FinishedPass);
+}
+
+// NOTE (MJP): Size of the heap block up to the end of the last allocated
+// chunk, which is all that needs saving.
+function memory_index
+GetUsedHeapSize(chunk_allocator *ChunkAllocator)
+{
+   u32 UsedChunkCount = ChunkAllocator->ChunkCount;
+   chunk_region *LastRegion =
+      GetRegion(ChunkAllocator, ChunkAllocator->RegionTable[ChunkAllocator->ChunkCount - 1]);
+   if (LastRegion->IsFree)
+   {
+      UsedChunkCount = LastRegion->StartIndex;
+   }
+
+   memory_index UsedSize =
+      ChunkAllocator->Layout.ChunkMemoryOffset + GetSizeBytes(ChunkAllocator, UsedChunkCount);
+   return(UsedSize);
+}
+
+// NOTE (MJP): Writes the used part of the heap block out in one go. Nothing
+// in the block is a pointer, so it can be loaded back at any address.
+function b32
+SaveAllocator(chunk_allocator *ChunkAllocator, char *FileName)
+{
+   chunk_heap_header *Header = (chunk_heap_header *)ChunkAllocator->Base;
+   Header->Magic = CHUNK_HEAP_MAGIC;
+   Header->Version = CHUNK_HEAP_VERSION;
+   Header->Params.ChunkSize = ChunkAllocator->ChunkSize;
+   Header->Params.ChunkCount = ChunkAllocator->ChunkCount;
+   Header->Params.Alignment = ChunkAllocator->Alignment;
+   Header->Params.Flags = ChunkAllocator->Flags;
+   Header->RegionCount = ChunkAllocator->RegionCount;
+   Header->FLBitmap = ChunkAllocator->FLBitmap;
+   MemCopy(Header->SLBitmap, ChunkAllocator->SLBitmap, SizeOf(Header->SLBitmap));
+   Header->UsedSize = GetUsedHeapSize(ChunkAllocator);
+
+   b32 Saved = false;
+   FILE *File = fopen(FileName, "wb");
+   if (File)
+   {
+      Saved = (fwrite(ChunkAllocator->Base, 1, Header->UsedSize, File) == Header->UsedSize);
+      fclose(File);
+   }
+   return(Saved);
+}
+
+// NOTE (MJP): Sets up a fresh heap from the saved header, then reads the rest
+// of the block straight into place. ChunkAllocator shouldn't be set up.
+function b32
+LoadAllocator(chunk_allocator *ChunkAllocator, char *FileName)
+{
+   b32 Loaded = false;
+   FILE *File = fopen(FileName, "rb");
+   if (File)
+   {
+      chunk_heap_header Header = {};
+      if ((fread(&Header, SizeOf(Header), 1, File) == 1) &&
+          (Header.Magic == CHUNK_HEAP_MAGIC) &&
+          (Header.Version == CHUNK_HEAP_VERSION) &&
+          IsValidChunkAllocatorParams(Header.Params))
+      {
+         chunk_heap_layout Layout = GetChunkHeapLayout(Header.Params);
+         if ((Header.UsedSize >= Layout.ChunkMemoryOffset) &&
+             (Header.UsedSize <= Layout.Size) &&
+             SetupAllocator(ChunkAllocator, Header.Params))
+         {
+            u32 UsedChunkCount =
+               (u32)((Header.UsedSize - Layout.ChunkMemoryOffset) >> ChunkAllocator->ChunkSizeLog2);
+            memory_index RemainingSize = Header.UsedSize - SizeOf(Header);
+
+            if (CommitChunks(ChunkAllocator, UsedChunkCount) &&
+                (fread(ChunkAllocator->Base + SizeOf(Header), 1, RemainingSize, File) == RemainingSize))
+            {
+               MemCopy(ChunkAllocator->Base, &Header, SizeOf(Header));
+               ChunkAllocator->RegionCount = Header.RegionCount;
+               ChunkAllocator->FLBitmap = Header.FLBitmap;
+               MemCopy(ChunkAllocator->SLBitmap, Header.SLBitmap, SizeOf(Header.SLBitmap));
+               ChunkStat(RebuildChunkAllocatorStats(ChunkAllocator));
+               Loaded = true;
+            }
+            else
+            {
+               ReleaseAllocator(ChunkAllocator);
+            }
+         }
+      }
+      fclose(File);
+   }
+   return(Loaded);
+}
+
+#define NULL_ALLOCATION 0x0
+// NOTE (MJP): User facing API
+#define NewAllocation(Allocator, Type, Count) (Type *)ResizeAllocationVoid(Allocator, (void *)NULL_ALLOCATION, SizeOf(Type)*Count)
+#define ResizeAllocation(Allocator, Allocation, Type, Count) (Type *)ResizeAllocationVoid((Allocator), (void *)(Allocation), SizeOf(Type)*(Count))
+
+#define FreeAllocation(Allocator, Allocation) FreeAllocationVoid((Allocator), (void *)(Allocation))
+
+// NOTE (MJP): Relative API, allocations are u32 chunk indices that stay valid
+// when the heap is saved and loaded somewhere else.
+#define NULL_ALLOCATION_INDEX NULL_INDEX_U32
+#define NewAllocationIndex(Allocator, Type, Count) ResizeAllocationIndex((Allocator), NULL_ALLOCATION_INDEX, SizeOf(Type)*(Count))
+#define ResizeAllocationIndexOf(Allocator, Index, Type, Count) ResizeAllocationIndex((Allocator), (Index), SizeOf(Type)*(Count))
+#define GetAllocationPointer(Allocator, Index, Type) ((Type *)GetMemoryAddress((Allocator), (u32)(Index)))
+
+//
+// Shared chunk allocator
+//
+// Several chunk_allocator arenas, each behind its own spin mutex, plus a
+// chunk_thread_cache per thread. Each thread cache is bound to one arena
+// (round robin), so threads on different arenas never touch the same lock
+// or the same heap metadata. Freed small regions stay allocated in their
+// arena and are parked in the freeing thread's cache, so most small
+// alloc/free pairs take no lock at all. When a cache bin fills up, half of
+// it is handed back to the owning arenas.
+//
+// Allocation indices are global: arena n owns indices [n*ArenaChunkCount,
+// (n + 1)*ArenaChunkCount). An allocation that doesn't fit in the thread's
+// arena is tried in the others, so one allocation can be at most
+// Params.ChunkCount / ArenaCount chunks.
+//
+// NOTE (MJP): Each thread sets up its own cache against the shared allocator
+// and must call FlushThreadCache before it exits, otherwise the cached
+// regions are leaked until the allocator is released. Allocations may be
+// freed from any thread, the free locks whichever arena owns them.
+//
+
+#define CHUNK_THREAD_CACHE_MAX_CHUNKS 8
+#define CHUNK_THREAD_CACHE_DEPTH 32
+#define CHUNK_ALLOCATOR_SHARED_MAX_ARENAS 16
+#define CHUNK_ALLOCATOR_SHARED_DEFAULT_ARENAS 4
+
+// NOTE (MJP): Padded so neighboring arenas' locks and bin bitmaps don't
+// share a cache line.
+struct chunk_allocator_arena
+{
+   spin_mutex Mutex;
+   u8 MutexPadding[L2_CACHE_SIZE - SizeOf(spin_mutex)];
+   chunk_allocator Allocator;
+   u8 AllocatorPadding[L2_CACHE_SIZE];
+};
+
+struct chunk_allocator_shared
+{
+   u32 ArenaCount;
+   u32 ArenaChunkCount;
+   // NOTE (MJP): Arena the next thread cache is bound to.
+   u32 volatile NextArena;
+   chunk_allocator_arena Arenas[CHUNK_ALLOCATOR_SHARED_MAX_ARENAS];
+};
+
+struct chunk_thread_cache
+{
+   chunk_allocator_shared *Shared;
+   u32 ArenaIndex;
+   // NOTE (MJP): Bin n holds (global) start indices of regions of n + 1
+   // chunks.
+   u32 Counts[CHUNK_THREAD_CACHE_MAX_CHUNKS];
+   u32 StartIndices[CHUNK_THREAD_CACHE_MAX_CHUNKS][CHUNK_THREAD_CACHE_DEPTH];
+};
+
+// NOTE (MJP): Params.ChunkCount is the total, split evenly between the
+// arenas.
+function void
+SetupAllocator(chunk_allocator_shared *Shared, chunk_allocator_params Params,
+               u32 ArenaCount = CHUNK_ALLOCATOR_SHARED_DEFAULT_ARENAS)
+{
+   Assert(ArenaCount && (ArenaCount <= CHUNK_ALLOCATOR_SHARED_MAX_ARENAS));
+   Assert(Params.ChunkCount >= ArenaCount);
+
+   ZeroStruct(*Shared);
+   Shared->ArenaCount = ArenaCount;
+   Shared->ArenaChunkCount = Params.ChunkCount / ArenaCount;
+   Params.ChunkCount = Shared->ArenaChunkCount;
+   for (u32 ArenaIndex = 0; ArenaIndex < ArenaCount; ++ArenaIndex)
+   {
+      SetupAllocator(&Shared->Arenas[ArenaIndex].Allocator, Params);
+   }
+}
+
+function void
+SetupAllocator(chunk_allocator_shared *Shared)
+{
+   SetupAllocator(Shared, DefaultChunkAllocatorParams());
+}
+
+function void
+ReleaseAllocator(chunk_allocator_shared *Shared)
+{
+   for (u32 ArenaIndex = 0; ArenaIndex < Shared->ArenaCount; ++ArenaIndex)
+   {
+      ReleaseAllocator(&Shared->Arenas[ArenaIndex].Allocator);
+   }
+   ZeroStruct(*Shared);
+}
+
+function void
+SetupThreadCache(chunk_thread_cache *Cache, chunk_allocator_shared *Shared)
+{
+   ZeroStruct(*Cache);
+   Cache->Shared = Shared;
+   Cache->ArenaIndex = AtomicIncrement(&Shared->NextArena) % Shared->ArenaCount;
+}
+
+inline chunk_allocator_arena *
+GetOwningArena(chunk_allocator_shared *Shared, u32 Index)
+{
+   Assert(Index < (Shared->ArenaCount*Shared->ArenaChunkCount));
+   chunk_allocator_arena *Result = Shared->Arenas + (Index / Shared->ArenaChunkCount);
+   return(Result);
+}
+
+inline u32
+GetArenaLocalIndex(chunk_allocator_shared *Shared, u32 Index)
+{
+   u32 Result = Index % Shared->ArenaChunkCount;
+   return(Result);
+}
+
+inline u32
+GetSharedIndex(chunk_allocator_shared *Shared, chunk_allocator_arena *Arena, u32 LocalIndex)
+{
+   u32 Result = NULL_INDEX_U32;
+   if (LocalIndex != NULL_INDEX_U32)
+   {
+      Result = (u32)(Arena - Shared->Arenas)*Shared->ArenaChunkCount + LocalIndex;
+   }
+   return(Result);
+}
+
+function void *
+GetMemoryAddress(chunk_allocator_shared *Shared, u32 Index)
+{
+   chunk_allocator_arena *Arena = GetOwningArena(Shared, Index);
+   void *Result = GetMemoryAddress(&Arena->Allocator, GetArenaLocalIndex(Shared, Index));
+   return(Result);
+}
+
+function u32
+GetChunkIndex(chunk_allocator_shared *Shared, void *Address)
+{
+   u32 Result = NULL_INDEX_U32;
+   for (u32 ArenaIndex = 0; ArenaIndex < Shared->ArenaCount; ++ArenaIndex)
+   {
+      chunk_allocator_arena *Arena = Shared->Arenas + ArenaIndex;
+      u32 LocalIndex = GetChunkIndex(&Arena->Allocator, Address);
+      if (LocalIndex != NULL_INDEX_U32)
+      {
+         Result = GetSharedIndex(Shared, Arena, LocalIndex);
+         break;
+      }
+   }
+   return(Result);
+}
+
+// NOTE (MJP): Frees the oldest Count entries of a bin, taking each owning
+// arena's lock once per run of entries from that arena.
+function void
+FlushThreadCacheBin(chunk_thread_cache *Cache, u32 BinIndex, u32 Count)
+{
+   Assert(Count <= Cache->Counts[BinIndex]);
+   chunk_allocator_shared *Shared = Cache->Shared;
+   u32 *StartIndices = Cache->StartIndices[BinIndex];
+
+   chunk_allocator_arena *LockedArena = 0;
+   for (u32 EntryIndex = 0; EntryIndex < Count; ++EntryIndex)
+   {
+      chunk_allocator_arena *Arena = GetOwningArena(Shared, StartIndices[EntryIndex]);
+      if (Arena != LockedArena)
+      {
+         if (LockedArena)
+         {
+            EndSpinMutex(&LockedArena->Mutex);
+         }
+         BeginSpinMutex(&Arena->Mutex);
+         LockedArena = Arena;
+      }
+      u32 LocalIndex = GetArenaLocalIndex(Shared, StartIndices[EntryIndex]);
+      FreeChunkRegion(&Arena->Allocator, GetAllocatedRegion(&Arena->Allocator, LocalIndex));
+   }
+   if (LockedArena)
+   {
+      EndSpinMutex(&LockedArena->Mutex);
+   }
+
+   u32 Remaining = Cache->Counts[BinIndex] - Count;
+   MemMove(StartIndices, StartIndices + Count, SizeOf(u32)*Remaining);
+   Cache->Counts[BinIndex] = Remaining;
+}
+
+function void
+FlushThreadCache(chunk_thread_cache *Cache)
+{
+   for (u32 BinIndex = 0; BinIndex < CHUNK_THREAD_CACHE_MAX_CHUNKS; ++BinIndex)
+   {
+      if (Cache->Counts[BinIndex])
+      {
+         FlushThreadCacheBin(Cache, BinIndex, Cache->Counts[BinIndex]);
+      }
+   }
+}
+
+// NOTE (MJP): Resize in the owning arena, under its lock. Returns a global
+// index.
+function u32
+ResizeInArena(chunk_allocator_shared *Shared, chunk_allocator_arena *Arena,
+              u32 LocalStartIndex, u32 SizeBytes)
+{
+   BeginSpinMutex(&Arena->Mutex);
+   u32 LocalIndex = ResizeAllocationIndex(&Arena->Allocator, LocalStartIndex, SizeBytes);
+   EndSpinMutex(&Arena->Mutex);
+
+   u32 Result = GetSharedIndex(Shared, Arena, LocalIndex);
+   return(Result);
+}
+
+// NOTE (MJP): Same semantics as the single threaded version. Only small
+// allocs and frees go through the cache, everything else locks the arena
+// that owns the allocation (or the thread's own arena for new ones).
+function u32
+ResizeAllocationIndex(chunk_thread_cache *Cache, u32 RegionStartIndex, u32 SizeBytes)
+{
+   chunk_allocator_shared *Shared = Cache->Shared;
+   // NOTE (MJP): All arenas share the chunk size.
+   chunk_allocator *FirstAllocator = &Shared->Arenas[0].Allocator;
+   u32 NewChunkCount = GetChunkCount(FirstAllocator, SizeBytes);
+
+   // NOTE (MJP): An allocated region is only ever changed by whoever owns
+   // it, so its count can be read without the lock.
+   chunk_allocator_arena *SourceArena = 0;
+   u32 SourceLocalIndex = NULL_INDEX_U32;
+   u32 SourceChunkCount = 0;
+   if (RegionStartIndex != NULL_INDEX_U32)
+   {
+      SourceArena = GetOwningArena(Shared, RegionStartIndex);
+      SourceLocalIndex = GetArenaLocalIndex(Shared, RegionStartIndex);
+      chunk_region *SourceRegion = GetAllocatedRegion(&SourceArena->Allocator, SourceLocalIndex);
+      Assert(SourceRegion);
+      SourceChunkCount = SourceRegion->Count;
+   }
+
+   u32 NewRegionStartIndex = NULL_INDEX_U32;
+   if (SourceChunkCount && (NewChunkCount == SourceChunkCount))
+   {
+      NewRegionStartIndex = RegionStartIndex;
+   }
+   else if (!SourceChunkCount && NewChunkCount &&
+            (NewChunkCount <= CHUNK_THREAD_CACHE_MAX_CHUNKS) &&
+            Cache->Counts[NewChunkCount - 1])
+   {
+      u32 BinIndex = NewChunkCount - 1;
+      NewRegionStartIndex = Cache->StartIndices[BinIndex][--Cache->Counts[BinIndex]];
+   }
+   else if (SourceChunkCount && !NewChunkCount &&
+            (SourceChunkCount <= CHUNK_THREAD_CACHE_MAX_CHUNKS))
+   {
+      u32 BinIndex = SourceChunkCount - 1;
+#if CHUNK_ALLOCATOR_DEBUG
+      // NOTE (MJP): Cached regions still look allocated to the arena, so
+      // double frees have to be caught here.
+      for (u32 EntryIndex = 0; EntryIndex < Cache->Counts[BinIndex]; ++EntryIndex)
+      {
+         AssertPrint(Cache->StartIndices[BinIndex][EntryIndex] != RegionStartIndex,
+                     "FreeAllocation: double free");
+      }
+#endif
+      PoisonChunks(GetMemoryAddress(Shared, RegionStartIndex),
+                   GetSizeBytes(FirstAllocator, SourceChunkCount));
+
+      if (Cache->Counts[BinIndex] == CHUNK_THREAD_CACHE_DEPTH)
+      {
+         FlushThreadCacheBin(Cache, BinIndex, CHUNK_THREAD_CACHE_DEPTH/2);
+      }
+      Cache->StartIndices[BinIndex][Cache->Counts[BinIndex]++] = RegionStartIndex;
+   }
+   else if (SourceArena)
+   {
+      NewRegionStartIndex = ResizeInArena(Shared, SourceArena, SourceLocalIndex, SizeBytes);
+      if ((NewRegionStartIndex == NULL_INDEX_U32) && NewChunkCount)
+      {
+         // NOTE (MJP): The owning arena is full, move to another one. The
+         // source is untouched by the failed resize.
+         u32 DestIndex = ResizeAllocationIndex(Cache, NULL_INDEX_U32, SizeBytes);
+         if (DestIndex != NULL_INDEX_U32)
+         {
+            MemCopy(GetMemoryAddress(Shared, DestIndex),
+                    GetMemoryAddress(Shared, RegionStartIndex),
+                    GetSizeBytes(FirstAllocator, Min(SourceChunkCount, NewChunkCount)));
+            ResizeInArena(Shared, SourceArena, SourceLocalIndex, 0);
+            NewRegionStartIndex = DestIndex;
+         }
+      }
+   }
+   else if (NewChunkCount)
+   {
+      // NOTE (MJP): The thread's own arena first, then the others.
+      for (u32 Attempt = 0;
+           (Attempt < Shared->ArenaCount) && (NewRegionStartIndex == NULL_INDEX_U32);
+           ++Attempt)
+      {
+         chunk_allocator_arena *Arena =
+            Shared->Arenas + ((Cache->ArenaIndex + Attempt) % Shared->ArenaCount);
+         NewRegionStartIndex = ResizeInArena(Shared, Arena, NULL_INDEX_U32, SizeBytes);
+      }
+   }
+
+   return(NewRegionStartIndex);
+}
+
+function void *
+ResizeAllocationVoid(chunk_thread_cache *Cache, void *RegionStartAddress, u32 SizeBytes)
+{
+   chunk_allocator_shared *Shared = Cache->Shared;
+   u32 NewRegionStartIndex =
+      ResizeAllocationIndex(Cache, GetChunkIndex(Shared, RegionStartAddress), SizeBytes);
+
+   void *NewRegionStartAddress = 0x0;
+   if (NewRegionStartIndex != NULL_INDEX_U32)
+   {
+      NewRegionStartAddress = GetMemoryAddress(Shared, NewRegionStartIndex);
+   }
+
+   return(NewRegionStartAddress);
+}
+
+function void
+FreeAllocationIndex(chunk_thread_cache *Cache, u32 RegionStartIndex)
+{
+   if (RegionStartIndex != NULL_INDEX_U32)
+   {
+      ResizeAllocationIndex(Cache, RegionStartIndex, 0);
+   }
+}
+
+function void
+FreeAllocationVoid(chunk_thread_cache *Cache, void *RegionStartAddress)
+{
+   if (RegionStartAddress)
+   {
+      FreeAllocationIndex(Cache, GetChunkIndex(Cache->Shared, RegionStartAddress));
+   }
+}
+
+//
+// Bitmap chunk allocator
+//
+// Alternative bookkeeping with no region nodes at all. Two bitmaps, one bit
+// per chunk each: OccupiedBits marks chunks in use and StartBits marks the
+// first chunk of every allocation. An allocation runs from its start bit up
+// to the next chunk that is either free or another start, so its length is
+// never stored. 1 << 18 chunks need 64 KiB of bitmaps (plus a 512 byte
+// summary), against several MiB of region nodes and region table for
+// chunk_allocator.
+//
+// NOTE (MJP): StartBits is what lets touching allocations be told apart.
+// The one bitmap alternative is a length header in front of each
+// allocation, which costs a whole chunk per allocation: 100k live 64 byte
+// allocations would pay 6.1 MiB for headers against 32 KiB for StartBits.
+//
+// Free runs are found first fit. Runs of up to 64 chunks are matched a word
+// at a time with shifts and ANDs; longer ones are walked run by run with
+// 64 bit word scans (ctz). FreeWordBits has a bit per OccupiedBits word that
+// has a free chunk, so full stretches of the heap are skipped 4096 chunks
+// per summary word. SearchHints, one
+// per size class (the classes of chunk_allocator's bins), remember how far
+// earlier searches got, so a search doesn't walk again over fragments too
+// small for it.
+//
+
+struct chunk_bitmap_allocator
+{
+   u32 ChunkSize;
+   u32 ChunkSizeLog2;
+   u32 ChunkCount;
+   u32 Alignment;
+   u32 Flags;
+
+   u32 WordCount;
+   // NOTE (MJP): No free run of at least GetSearchHintMinCount(n) chunks
+   // starts below chunk SearchHints[n]. Allocating raises them, freeing
+   // lowers them, and they never decrease with n.
+   u32 SearchHints[CHUNK_ALLOCATOR_BIN_COUNT];
+
+   u8 *Base;
+   memory_index Size;
+   memory_index CommittedSize;
+
+   u64 *OccupiedBits;
+   u64 *StartBits;
+   // NOTE (MJP): Bit n is set when OccupiedBits word n has a free chunk.
+   u64 *FreeWordBits;
+   u8 *ChunkMemory;
+};
+
+function u32
+GetChunkCount(chunk_bitmap_allocator *Allocator, u32 SizeBytes)
+{
+   u32 ChunkCount =
+      (u32)(((memory_index)SizeBytes + (Allocator->ChunkSize - 1)) >>
+            Allocator->ChunkSizeLog2);
+   return(ChunkCount);
+}
+
+function memory_index
+GetSizeBytes(chunk_bitmap_allocator *Allocator, u32 ChunkCount)
+{
+   memory_index SizeBytes = (memory_index)ChunkCount << Allocator->ChunkSizeLog2;
+   return(SizeBytes);
+}
+
+function void *
+GetMemoryAddress(chunk_bitmap_allocator *Allocator, u32 ChunkIndex)
+{
+   void *Address = (void *)(Allocator->ChunkMemory + GetSizeBytes(Allocator, ChunkIndex));
+   return(Address);
+}
+
+// NOTE (MJP): Returns NULL_INDEX_U32 for addresses outside chunk memory
+// (including the null allocation).
+function u32
+GetChunkIndex(chunk_bitmap_allocator *Allocator, void *Address)
+{
+   u32 ChunkIndex = NULL_INDEX_U32;
+
+   memory_index ChunkMemoryStart = (memory_index)Allocator->ChunkMemory;
+   memory_index ChunkMemoryEnd =
+      ChunkMemoryStart + GetSizeBytes(Allocator, Allocator->ChunkCount);
+
+   if (((memory_index)Address >= ChunkMemoryStart) &&
+       ((memory_index)Address < ChunkMemoryEnd))
+   {
+      ChunkIndex =
+         (u32)(((memory_index)Address - ChunkMemoryStart) >> Allocator->ChunkSizeLog2);
+   }
+
+   return(ChunkIndex);
+}
+
+inline b32
+GetChunkBit(u64 *Bitmap, u32 ChunkIndex)
+{
+   b32 Result = (b32)((Bitmap[ChunkIndex >> 6] >> (ChunkIndex & 63)) & 1);
+   return(Result);
+}
+
+// NOTE (MJP): Sets or clears Count bits starting at StartIndex, a word at a
+// time.
+function void
+SetChunkBits(u64 *Bitmap, u32 StartIndex, u32 Count, b32 Set)
+{
+   u32 Index = StartIndex;
+   u32 OPEIndex = StartIndex + Count;
+   while (Index < OPEIndex)
+   {
+      u32 BitIndex = Index & 63;
+      u32 BitCount = Min(64 - BitIndex, OPEIndex - Index);
+      u64 Mask = (BitCount == 64) ? U64_MAX : (((1ULL << BitCount) - 1) << BitIndex);
+      if (Set)
+      {
+         Bitmap[Index >> 6] |= Mask;
+      }
+      else
+      {
+         Bitmap[Index >> 6] &= ~Mask;
+      }
+      Index += BitCount;
+   }
+}
+
+// NOTE (MJP): Marks Count chunks from StartIndex in use (Set) or free, and
+// keeps FreeWordBits in step.
+function void
+SetOccupiedBits(chunk_bitmap_allocator *Allocator, u32 StartIndex, u32 Count, b32 Set)
+{
+   SetChunkBits(Allocator->OccupiedBits, StartIndex, Count, Set);
+   u32 OPEWordIndex = ((StartIndex + Count - 1) >> 6) + 1;
+   for (u32 WordIndex = StartIndex >> 6; WordIndex < OPEWordIndex; ++WordIndex)
+   {
+      u64 Bit = 1ULL << (WordIndex & 63);
+      if (Allocator->OccupiedBits[WordIndex] == U64_MAX)
+      {
+         Allocator->FreeWordBits[WordIndex >> 6] &= ~Bit;
+      }
+      else
+      {
+         Allocator->FreeWordBits[WordIndex >> 6] |= Bit;
+      }
+   }
+}
+
+// NOTE (MJP): Index of the first free chunk at or after FromIndex, or
+// ChunkCount if there isn't one. Full words are skipped through
+// FreeWordBits. The padding bits past ChunkCount are always marked in use.
+function u32
+FindNextFreeChunk(chunk_bitmap_allocator *Allocator, u32 FromIndex)
+{
+   u32 FoundIndex = Allocator->ChunkCount;
+   if (FromIndex < Allocator->ChunkCount)
+   {
+      u32 WordIndex = FromIndex >> 6;
+      u64 Word = ~Allocator->OccupiedBits[WordIndex] & (U64_MAX << (FromIndex & 63));
+      if (!Word)
+      {
+         WordIndex = Allocator->WordCount;
+         u32 NextWordIndex = (FromIndex >> 6) + 1;
+         u32 SummaryCount = (Allocator->WordCount + 63) >> 6;
+         u32 SummaryIndex = NextWordIndex >> 6;
+         u64 Summary = 0;
+         if (SummaryIndex < SummaryCount)
+         {
+            Summary = Allocator->FreeWordBits[SummaryIndex] & (U64_MAX << (NextWordIndex & 63));
+         }
+         while (!Summary && (++SummaryIndex < SummaryCount))
+         {
+            Summary = Allocator->FreeWordBits[SummaryIndex];
+         }
+         if (Summary)
+         {
+            WordIndex = (SummaryIndex << 6) + FindLeastSignificantSetBit(Summary).Index;
+            Word = ~Allocator->OccupiedBits[WordIndex];
+         }
+      }
+
+      if (Word)
+      {
+         FoundIndex = Min((WordIndex << 6) + FindLeastSignificantSetBit(Word).Index,
+                          Allocator->ChunkCount);
+      }
+   }
+   return(FoundIndex);
+}
+
+// NOTE (MJP): Index of the first chunk in use at or after FromIndex. Stops
+// looking at OPEIndex, returning OPEIndex (or more) when [FromIndex,
+// OPEIndex) is all free.
+function u32
+FindNextUsedChunk(chunk_bitmap_allocator *Allocator, u32 FromIndex, u32 OPEIndex)
+{
+   u32 FoundIndex = OPEIndex;
+   u32 WordIndex = FromIndex >> 6;
+   u64 Word = Allocator->OccupiedBits[WordIndex] & (U64_MAX << (FromIndex & 63));
+   for (;;)
+   {
+      bit_scan_result Scan = FindLeastSignificantSetBit(Word);
+      if (Scan.Found)
+      {
+         FoundIndex = (WordIndex << 6) + Scan.Index;
+         break;
+      }
+      if ((++WordIndex << 6) >= OPEIndex)
+      {
+         break;
+      }
+      Word = Allocator->OccupiedBits[WordIndex];
+   }
+   return(FoundIndex);
+}
+
+// NOTE (MJP): First fit for runs of up to 64 chunks, a word at a time: the
+// free bits of a word and the next one are ANDed with themselves shifted
+// (doubling the run length each step) until each remaining bit starts a run
+// of ChunkCount free chunks. Returns ChunkCount (the allocator's) if there
+// isn't one.
+function u32
+FindFreeRunInWords(chunk_bitmap_allocator *Allocator, u32 FromIndex, u32 ChunkCount)
+{
+   Assert(ChunkCount && (ChunkCount <= 64));
+   u32 FoundIndex = Allocator->ChunkCount;
+   u32 FreeIndex = FindNextFreeChunk(Allocator, FromIndex);
+   while (FreeIndex < Allocator->ChunkCount)
+   {
+      u32 WordIndex = FreeIndex >> 6;
+      u64 Low = ~Allocator->OccupiedBits[WordIndex] & (U64_MAX << (FreeIndex & 63));
+      u64 High = ((WordIndex + 1) < Allocator->WordCount) ? ~Allocator->OccupiedBits[WordIndex + 1] : 0;
+      for (u32 RunLength = 1; Low && (RunLength < ChunkCount);)
+      {
+         u32 Shift = Min(RunLength, ChunkCount - RunLength);
+         Low &= (Low >> Shift) | (High << (64 - Shift));
+         High &= High >> Shift;
+         RunLength += Shift;
+      }
+
+      if (Low)
+      {
+         FoundIndex = (WordIndex << 6) + FindLeastSignificantSetBit(Low).Index;
+         break;
+      }
+      FreeIndex = FindNextFreeChunk(Allocator, (WordIndex + 1) << 6);
+   }
+   return(FoundIndex);
+}
+
+// NOTE (MJP): Start of the free run that chunk Index (free) is in.
+function u32
+FindFreeRunStart(chunk_bitmap_allocator *Allocator, u32 Index)
+{
+   u32 RunStart = 0;
+   u32 WordIndex = Index >> 6;
+   u64 Word = Allocator->OccupiedBits[WordIndex] & ((1ULL << (Index & 63)) - 1);
+   for (;;)
+   {
+      bit_scan_result Scan = FindMostSignificantSetBit(Word);
+      if (Scan.Found)
+      {
+         RunStart = (WordIndex << 6) + Scan.Index + 1;
+         break;
+      }
+      if (!WordIndex--)
+      {
+         break;
+      }
+      Word = Allocator->OccupiedBits[WordIndex];
+   }
+   return(RunStart);
+}
+
+inline u32
+GetSearchHintIndex(u32 ChunkCount)
+{
+   chunk_bin_index BinIndex = GetBinIndexForInsert(ChunkCount);
+   u32 Result = BinIndex.FL*CHUNK_ALLOCATOR_SL_COUNT + BinIndex.SL;
+   return(Result);
+}
+
+// NOTE (MJP): Smallest chunk count in the class.
+inline u64
+GetSearchHintMinCount(u32 HintIndex)
+{
+   u32 FL = HintIndex / CHUNK_ALLOCATOR_SL_COUNT;
+   u32 SL = HintIndex % CHUNK_ALLOCATOR_SL_COUNT;
+   u64 Result = FL ? ((u64)(CHUNK_ALLOCATOR_SL_COUNT + SL) << (FL - 1)) : SL;
+   return(Result);
+}
+
+// NOTE (MJP): Count chunks from Index were just freed. Only the classes the
+// merged free run is big enough for are lowered, and the run is only
+// scanned as far as the biggest of those needs.
+function void
+LowerSearchHints(chunk_bitmap_allocator *Allocator, u32 Index, u32 Count)
+{
+   u32 RunStart = Index;
+   if (Index && !GetChunkBit(Allocator->OccupiedBits, Index - 1))
+   {
+      RunStart = FindFreeRunStart(Allocator, Index);
+   }
+
+   // NOTE (MJP): The hints are sorted, so the ones above RunStart are a
+   // suffix. Binary search for where it begins.
+   u32 HintIndex = 1;
+   u32 OPEHintIndex = CHUNK_ALLOCATOR_BIN_COUNT;
+   while (HintIndex < OPEHintIndex)
+   {
+      u32 MidIndex = HintIndex + (OPEHintIndex - HintIndex) / 2;
+      if (Allocator->SearchHints[MidIndex] > RunStart)
+      {
+         OPEHintIndex = MidIndex;
+      }
+      else
+      {
+         HintIndex = MidIndex + 1;
+      }
+   }
+
+   u32 FreeTo = Index + Count;
+   for (; HintIndex < CHUNK_ALLOCATOR_BIN_COUNT; ++HintIndex)
+   {
+      u64 ClassEnd = RunStart + GetSearchHintMinCount(HintIndex);
+      if (ClassEnd > Allocator->ChunkCount)
+      {
+         break;
+      }
+      if (FreeTo < ClassEnd)
+      {
+         FreeTo = FindNextUsedChunk(Allocator, FreeTo, (u32)ClassEnd);
+         if (FreeTo < ClassEnd)
+         {
+            break;
+         }
+      }
+      Allocator->SearchHints[HintIndex] = RunStart;
+   }
+}
+
+// NOTE (MJP): One past the last chunk of the allocation starting at
+// StartIndex, i.e. the next chunk that is free or starts another allocation.
+function u32
+FindAllocationEnd(chunk_bitmap_allocator *Allocator, u32 StartIndex)
+{
+   u32 FromIndex = StartIndex + 1;
+   u32 EndIndex = Allocator->ChunkCount;
+   if (FromIndex < Allocator->ChunkCount)
+   {
+      u32 WordIndex = FromIndex >> 6;
+      u64 Mask = U64_MAX << (FromIndex & 63);
+      for (;;)
+      {
+         u64 Word = (~Allocator->OccupiedBits[WordIndex] | Allocator->StartBits[WordIndex]) & Mask;
+         bit_scan_result Scan = FindLeastSignificantSetBit(Word);
+         if (Scan.Found)
+         {
+            EndIndex = Min((WordIndex << 6) + Scan.Index, Allocator->ChunkCount);
+            break;
+         }
+         if (++WordIndex == Allocator->WordCount)
+         {
+            break;
+         }
+         Mask = U64_MAX;
+      }
+   }
+   return(EndIndex);
+}
+
+// NOTE (MJP): Chunk count of the allocation starting at StartIndex, 0 if
+// there is no allocation starting there.
+function u32
+GetAllocationChunkCount(chunk_bitmap_allocator *Allocator, u32 StartIndex)
+{
+   u32 ChunkCount = 0;
+   if ((StartIndex < Allocator->ChunkCount) &&
+       GetChunkBit(Allocator->StartBits, StartIndex))
+   {
+      ChunkCount = FindAllocationEnd(Allocator, StartIndex) - StartIndex;
+   }
+   return(ChunkCount);
+}
+
+function b32
+CommitChunks(chunk_bitmap_allocator *Allocator, u32 OPEChunkIndex)
+{
+   b32 Committed = true;
+   if (GetFlag(Allocator->Flags, CHUNK_ALLOCATOR_FLAG_COMMIT_ON_DEMAND))
+   {
+      memory_index RequiredSize = GetSizeBytes(Allocator, OPEChunkIndex);
+      if (RequiredSize > Allocator->CommittedSize)
+      {
+         memory_index ReservedSize = Allocator->Size - (Allocator->ChunkMemory - Allocator->Base);
+         memory_index NewCommittedSize =
+            Min(AlignPow2(RequiredSize, GetCommitSize(Allocator->Flags)),
+                ReservedSize);
+         Committed = CommitMemory(Allocator->ChunkMemory + Allocator->CommittedSize,
+                                  NewCommittedSize - Allocator->CommittedSize,
+                                  GetMemoryFlags(Allocator->Flags));
+         if (Committed)
+         {
+            Allocator->CommittedSize = NewCommittedSize;
+         }
+      }
+   }
+   return(Committed);
+}
+
+function void
+SetupAllocator(chunk_bitmap_allocator *Allocator, chunk_allocator_params Params)
+{
+   Assert(Params.ChunkSize && !(Params.ChunkSize & (Params.ChunkSize - 1)));
+   Assert(Params.Alignment && !(Params.Alignment & (Params.Alignment - 1)));
+   Assert(Params.Alignment <= Params.ChunkSize);
+   Assert(Params.Alignment <= SYSTEM_PAGE_SIZE);
+   Assert(Params.ChunkCount);
+   // NOTE (MJP): Memory is never decommitted, only committed on demand.
+   Assert(!GetFlag(Params.Flags, CHUNK_ALLOCATOR_FLAG_DECOMMIT_FREE_TAIL));
+
+   ZeroStruct(*Allocator);
+   Allocator->ChunkSize = Params.ChunkSize;
+   Allocator->ChunkSizeLog2 = FindMostSignificantSetBit(Params.ChunkSize).Index;
+   Allocator->ChunkCount = Params.ChunkCount;
+   Allocator->Alignment = Params.Alignment;
+   Allocator->Flags = Params.Flags;
+   Allocator->WordCount = (Params.ChunkCount + 63) >> 6;
+
+   memory_index BitmapSize = SizeOf(u64)*Allocator->WordCount;
+   memory_index SummarySize = SizeOf(u64)*((Allocator->WordCount + 63) >> 6);
+   memory_index ChunkMemoryAlignment =
+      GetFlag(Params.Flags, CHUNK_ALLOCATOR_FLAG_HUGE_PAGES) ? HUGE_PAGE_SIZE : SYSTEM_PAGE_SIZE;
+   memory_index ChunkMemoryOffset = AlignPow2(2*BitmapSize + SummarySize, ChunkMemoryAlignment);
+   memory_index ChunkMemorySize = GetSizeBytes(Allocator, Params.ChunkCount);
+   Allocator->Size = AlignPow2(ChunkMemoryOffset + ChunkMemorySize, (memory_index)SYSTEM_PAGE_SIZE);
+
+   u32 MemoryFlags = GetMemoryFlags(Allocator->Flags);
+   Allocator->Base = (u8 *)ReserveMemory(Allocator->Size, MemoryFlags);
+   Assert(Allocator->Base);
+   CommitMemory(Allocator->Base, ChunkMemoryOffset, MemoryFlags);
+
+   Allocator->OccupiedBits = (u64 *)Allocator->Base;
+   Allocator->StartBits = (u64 *)(Allocator->Base + BitmapSize);
+   Allocator->FreeWordBits = (u64 *)(Allocator->Base + 2*BitmapSize);
+   Allocator->ChunkMemory = Allocator->Base + ChunkMemoryOffset;
+
+   if (!GetFlag(Allocator->Flags, CHUNK_ALLOCATOR_FLAG_COMMIT_ON_DEMAND))
+   {
+      Allocator->CommittedSize = Allocator->Size - ChunkMemoryOffset;
+      CommitMemory(Allocator->ChunkMemory, Allocator->CommittedSize, MemoryFlags);
+   }
+
+   // NOTE (MJP): Padding past the last chunk reads as in use, so scans never
+   // have to check the tail.
+   SetChunkBits(Allocator->FreeWordBits, 0, Allocator->WordCount, true);
+   u32 PaddingCount = (Allocator->WordCount << 6) - Allocator->ChunkCount;
+   if (PaddingCount)
+   {
+      SetOccupiedBits(Allocator, Allocator->ChunkCount, PaddingCount, true);
+   }
+}
+
+function void
+SetupAllocator(chunk_bitmap_allocator *Allocator)
+{
+   SetupAllocator(Allocator, DefaultChunkAllocatorParams());
+}
+
+function void
+ReleaseAllocator(chunk_bitmap_allocator *Allocator)
+{
+   if (Allocator->Base)
+   {
+      ReleaseMemory(Allocator->Base, Allocator->Size);
+   }
+   ZeroStruct(*Allocator);
+}
+
+function void
+CheckForClashingRegions(chunk_bitmap_allocator *Allocator)
+{
+   for (u32 HintIndex = 2; HintIndex < CHUNK_ALLOCATOR_BIN_COUNT; ++HintIndex)
+   {
+      Assert(Allocator->SearchHints[HintIndex - 1] <= Allocator->SearchHints[HintIndex]);
+   }
+
+   for (u32 WordIndex = 0; WordIndex < Allocator->WordCount; ++WordIndex)
+   {
+      // NOTE (MJP): Every start has to be in use, and the summary has to
+      // match the words.
+      Assert(!(Allocator->StartBits[WordIndex] & ~Allocator->OccupiedBits[WordIndex]));
+      Assert(GetChunkBit(Allocator->FreeWordBits, WordIndex) ==
+             (Allocator->OccupiedBits[WordIndex] != U64_MAX));
+   }
+
+   // NOTE (MJP): Every in use run has to begin with a start bit, and no free
+   // run can start below the hint for its size.
+   for (u32 ChunkIndex = 0; ChunkIndex < Allocator->ChunkCount;)
+   {
+      u32 UsedIndex = FindNextUsedChunk(Allocator, ChunkIndex, Allocator->ChunkCount);
+#if ASSERTS_ENABLED
+      u32 FreeCount = Min(UsedIndex, Allocator->ChunkCount) - ChunkIndex;
+      for (u32 HintIndex = 1; HintIndex < CHUNK_ALLOCATOR_BIN_COUNT; ++HintIndex)
+      {
+         Assert((FreeCount < GetSearchHintMinCount(HintIndex)) ||
+                (ChunkIndex >= Allocator->SearchHints[HintIndex]));
+      }
+#endif
+
+      if (UsedIndex < Allocator->ChunkCount)
+      {
+         Assert(GetChunkBit(Allocator->StartBits, UsedIndex));
+         ChunkIndex = FindNextFreeChunk(Allocator, UsedIndex);
+      }
+      else
+      {
+         ChunkIndex = Allocator->ChunkCount;
+      }
+   }
+}
+
+// NOTE (MJP): First fit, starting from the hint for ChunkCount's size class.
+// Returns NULL_INDEX_U32 if there is no free run of ChunkCount chunks.
+function u32
+AllocateChunks(chunk_bitmap_allocator *Allocator, u32 ChunkCount)
+{
+   Assert(ChunkCount);
+
+   u32 FoundIndex = NULL_INDEX_U32;
+   u32 HintIndex = GetSearchHintIndex(ChunkCount);
+   if (ChunkCount <= 64)
+   {
+      FoundIndex = FindFreeRunInWords(Allocator, Allocator->SearchHints[HintIndex], ChunkCount);
+      if (FoundIndex == Allocator->ChunkCount)
+      {
+         FoundIndex = NULL_INDEX_U32;
+      }
+   }
+   else
+   {
+      // NOTE (MJP): Longer runs are walked one free run at a time.
+      u32 FreeIndex = FindNextFreeChunk(Allocator, Allocator->SearchHints[HintIndex]);
+      while ((FreeIndex < Allocator->ChunkCount) &&
+             (ChunkCount <= (Allocator->ChunkCount - FreeIndex)))
+      {
+         u32 UsedIndex = FindNextUsedChunk(Allocator, FreeIndex, FreeIndex + ChunkCount);
+         if ((UsedIndex - FreeIndex) >= ChunkCount)
+         {
+            FoundIndex = FreeIndex;
+            break;
+         }
+         FreeIndex = FindNextFreeChunk(Allocator, UsedIndex);
+      }
+   }
+
+   // NOTE (MJP): Nothing below where the search stopped could hold
+   // ChunkCount chunks, so that goes for every class that starts at
+   // ChunkCount or more. Those past the first one already that high are too.
+   u32 SearchEnd = (FoundIndex != NULL_INDEX_U32) ? FoundIndex : Allocator->ChunkCount;
+   u32 RaisedIndex = HintIndex + ((GetSearchHintMinCount(HintIndex) != ChunkCount) ? 1 : 0);
+   for (; (RaisedIndex < CHUNK_ALLOCATOR_BIN_COUNT) &&
+          (Allocator->SearchHints[RaisedIndex] < SearchEnd);
+        ++RaisedIndex)
+   {
+      Allocator->SearchHints[RaisedIndex] = SearchEnd;
+   }
+
+   if ((FoundIndex != NULL_INDEX_U32) &&
+       CommitChunks(Allocator, FoundIndex + ChunkCount))
+   {
+      SetOccupiedBits(Allocator, FoundIndex, ChunkCount, true);
+      SetChunkBits(Allocator->StartBits, FoundIndex, 1, true);
+   }
+   else
+   {
+      FoundIndex = NULL_INDEX_U32;
+   }
+
+   return(FoundIndex);
+}
+
+function void
+FreeChunks(chunk_bitmap_allocator *Allocator, u32 StartIndex, u32 ChunkCount)
+{
+   PoisonChunks(GetMemoryAddress(Allocator, StartIndex), GetSizeBytes(Allocator, ChunkCount));
+   SetOccupiedBits(Allocator, StartIndex, ChunkCount, false);
+   SetChunkBits(Allocator->StartBits, StartIndex, 1, false);
+   LowerSearchHints(Allocator, StartIndex, ChunkCount);
+}
+
+function b32
+ResizeChunksInPlace(chunk_bitmap_allocator *Allocator, u32 StartIndex,
+                    u32 ChunkCount, u32 NewChunkCount)
+{
+   b32 Resized = false;
+   u32 EndIndex = StartIndex + ChunkCount;
+   if (NewChunkCount <= ChunkCount)
+   {
+      // NOTE (MJP): Only the tail goes, the start bit stays.
+      u32 TailStartIndex = StartIndex + NewChunkCount;
+      PoisonChunks(GetMemoryAddress(Allocator, TailStartIndex),
+                   GetSizeBytes(Allocator, ChunkCount - NewChunkCount));
+      if (NewChunkCount < ChunkCount)
+      {
+         SetOccupiedBits(Allocator, TailStartIndex, ChunkCount - NewChunkCount, false);
+         LowerSearchHints(Allocator, TailStartIndex, ChunkCount - NewChunkCount);
+      }
+      Resized = true;
+   }
+   else if ((StartIndex + NewChunkCount) <= Allocator->ChunkCount)
+   {
+      u32 NewEndIndex = StartIndex + NewChunkCount;
+      if ((FindNextUsedChunk(Allocator, EndIndex, NewEndIndex) >= NewEndIndex) &&
+          CommitChunks(Allocator, NewEndIndex))
+      {
+         SetOccupiedBits(Allocator, EndIndex, NewEndIndex - EndIndex, true);
+         Resized = true;
+      }
+   }
+   return(Resized);
+}
+
+// NOTE (MJP): Same semantics as chunk_allocator's: when there's no room it
+// returns NULL_INDEX_U32 and leaves the source allocation as it was.
+function u32
+ResizeAllocationIndex(chunk_bitmap_allocator *Allocator, u32 RegionStartIndex, u32 SizeBytes)
+{
+   u32 SourceChunkCount = 0;
+   if (RegionStartIndex != NULL_INDEX_U32)
+   {
+      SourceChunkCount = GetAllocationChunkCount(Allocator, RegionStartIndex);
+      Assert(SourceChunkCount);
+   }
+
+   u32 NewRegionStartIndex = NULL_INDEX_U32;
+   u32 NewChunkCount = GetChunkCount(Allocator, SizeBytes);
+
+   if (NewChunkCount)
+   {
+      if (SourceChunkCount &&
+          ResizeChunksInPlace(Allocator, RegionStartIndex, SourceChunkCount, NewChunkCount))
+      {
+         NewRegionStartIndex = RegionStartIndex;
+      }
+      else
+      {
+         NewRegionStartIndex = AllocateChunks(Allocator, NewChunkCount);
+         if ((NewRegionStartIndex != NULL_INDEX_U32) && SourceChunkCount)
+         {
+            memory_index CopySizeBytes =
+               GetSizeBytes(Allocator, Min(SourceChunkCount, NewChunkCount));
+            MemCopy(GetMemoryAddress(Allocator, NewRegionStartIndex),
+                    GetMemoryAddress(Allocator, RegionStartIndex), (u32)CopySizeBytes);
+            FreeChunks(Allocator, RegionStartIndex, SourceChunkCount);
+         }
+      }
+   }
+   else if (SourceChunkCount)
+   {
+      FreeChunks(Allocator, RegionStartIndex, SourceChunkCount);
+   }
+
+   return(NewRegionStartIndex);
+}
+
+function void *
+ResizeAllocationVoid(chunk_bitmap_allocator *Allocator, void *RegionStartAddress, u32 SizeBytes)
+{
+   u32 NewRegionStartIndex =
+      ResizeAllocationIndex(Allocator, GetChunkIndex(Allocator, RegionStartAddress), SizeBytes);
+
+   void *NewRegionStartAddress = 0x0;
+   if (NewRegionStartIndex != NULL_INDEX_U32)
+   {
+      NewRegionStartAddress = GetMemoryAddress(Allocator, NewRegionStartIndex);
+   }
+
+   return(NewRegionStartAddress);
+}
+
+// NOTE (MJP): Constant time apart from finding the end of the allocation,
+// which is a scan of its own bits.
+function void
+FreeAllocationIndex(chunk_bitmap_allocator *Allocator, u32 RegionStartIndex)
+{
+   if (RegionStartIndex != NULL_INDEX_U32)
+   {
+      u32 ChunkCount = GetAllocationChunkCount(Allocator, RegionStartIndex);
+      AssertPrint(ChunkCount, "FreeAllocation: double free, or not the start of an allocation");
+      if (ChunkCount)
+      {
+         FreeChunks(Allocator, RegionStartIndex, ChunkCount);
+      }
+   }
+}
+
+function void
+FreeAllocationVoid(chunk_bitmap_allocator *Allocator, void *RegionStartAddress)
+{
+   if (RegionStartAddress)
+   {
+      FreeAllocationIndex(Allocator, GetChunkIndex(Allocator, RegionStartAddress));
+   }
+}
+
+
+//
+// SECTION: STRETCHY BUFFERS
+//
+// Typed growable arrays in the style of stb's stretchy_buffer. The buffer is
+// a plain Type * to the elements, with a header in front of them that holds
+// the count, capacity and the allocator it grows on (a memory_arena or a
+// chunk_allocator). Capacity doubles as it grows, so pushes are amortized
+// constant time.
+//
+//    u32 *Values = 0;
+//    BufInit(Values, &Arena, 16);
+//    BufPush(Values, 7);
+//    for (u32 Index = 0; Index < BufCount(Values); ++Index) ...
+//
+// Growth happens in place when the allocator can extend the block: on an
+// arena when the buffer is the last thing pushed, on a chunk allocator when
+// the chunks to the right are free. Otherwise the buffer moves, so pointers
+// into it are only good until the next push or insert. On an arena the old
+// block is abandoned until the arena is popped.
+//
+
+#define BUF_MIN_CAPACITY 8
+#define BUF_ALIGNMENT 16
+
+struct buf_header
+{
+   memory_arena *Arena;
+   chunk_allocator *ChunkAllocator;
+   u32 Count;
+   u32 Capacity;
+};
+
+// NOTE (MJP): Elements start BUF_ALIGNMENT aligned after the header.
+#define BUF_HEADER_SIZE AlignPow2(SizeOf(buf_header), (memory_index)BUF_ALIGNMENT)
+
+#define BufHeader(Buffer) ((buf_header *)((u8 *)(Buffer) - BUF_HEADER_SIZE))
+#define BufCount(Buffer) ((Buffer) ? BufHeader(Buffer)->Count : 0)
+#define BufCapacity(Buffer) ((Buffer) ? BufHeader(Buffer)->Capacity : 0)
+#define BufLast(Buffer) ((Buffer)[BufHeader(Buffer)->Count - 1])
+#define BufEnd(Buffer) ((Buffer) + BufCount(Buffer))
+
+function void *
+BufInitHeader_(buf_header *Header, memory_index Size, memory_index ElementSize)
+{
+   void *Buffer = 0;
+   if (Header)
+   {
+      Header->Count = 0;
+      Header->Capacity = (u32)((Size - BUF_HEADER_SIZE) / ElementSize);
+      Buffer = (u8 *)Header + BUF_HEADER_SIZE;
+   }
+   return(Buffer);
+}
+
+function void *
+BufInit_(memory_arena *Arena, u32 Capacity, memory_index ElementSize)
+{
+   memory_index Size = BUF_HEADER_SIZE + ElementSize*Capacity;
+   buf_header *Header = (buf_header *)PushSize_(Arena, Size, BUF_ALIGNMENT);
+   if (Header)
+   {
+      Header->Arena = Arena;
+      Header->ChunkAllocator = 0;
+   }
+   void *Buffer = BufInitHeader_(Header, Size, ElementSize);
+   return(Buffer);
+}
+
+// NOTE (MJP): The capacity is rounded up to whatever fits in the chunks.
+function void *
+BufInit_(chunk_allocator *ChunkAllocator, u32 Capacity, memory_index ElementSize)
+{
+   Assert(ChunkAllocator->Alignment >= BUF_ALIGNMENT);
+   memory_index Size = BUF_HEADER_SIZE + ElementSize*Capacity;
+   buf_header *Header = 0;
+   if (Size <= U32_MAX)
+   {
+      Header = (buf_header *)ResizeAllocationVoid(ChunkAllocator, (void *)NULL_ALLOCATION, (u32)Size);
+   }
+   if (Header)
+   {
+      Header->Arena = 0;
+      Header->ChunkAllocator = ChunkAllocator;
+      Size = GetSizeBytes(ChunkAllocator, GetChunkCount(ChunkAllocator, (u32)Size));
+   }
+   void *Buffer = BufInitHeader_(Header, Size, ElementSize);
+   return(Buffer);
+}
+
+// NOTE (MJP): Makes room for at least MinCapacity elements, returns the
+// (possibly moved) buffer. If the allocator is out of memory the buffer is
+// returned unchanged, with its old capacity, so check BufCapacity (or use
+// the Buf* macros below, which do).
+function void *
+BufGrow_(void *Buffer, u64 MinCapacity, memory_index ElementSize)
+{
+   Assert(Buffer);
+   buf_header *Header = BufHeader(Buffer);
+
+   if (MinCapacity > Header->Capacity)
+   {
+      // NOTE (MJP): Doubling stops at the largest capacity the header (and,
+      // on a chunk allocator, a u32 byte size) can hold. Past that it fails.
+      memory_index MaxSize = Header->ChunkAllocator ? U32_MAX : ~(memory_index)0;
+      u64 MaxCapacity = Min((u64)U32_MAX, (u64)((MaxSize - BUF_HEADER_SIZE) / ElementSize));
+      u64 NewCapacity = Min(Max(Max(2*(u64)Header->Capacity, MinCapacity), (u64)BUF_MIN_CAPACITY),
+                            MaxCapacity);
+      memory_index OldSize = BUF_HEADER_SIZE + ElementSize*Header->Capacity;
+      memory_index NewSize = BUF_HEADER_SIZE + ElementSize*NewCapacity;
+
+      buf_header *NewHeader = 0;
+      if (MinCapacity <= NewCapacity)
+      {
+         if (Header->ChunkAllocator)
+         {
+            chunk_allocator *ChunkAllocator = Header->ChunkAllocator;
+            NewHeader = (buf_header *)ResizeAllocationVoid(ChunkAllocator, Header, (u32)NewSize);
+            NewSize = GetSizeBytes(ChunkAllocator, GetChunkCount(ChunkAllocator, (u32)NewSize));
+         }
+         else
+         {
+            memory_arena *Arena = Header->Arena;
+            if ((((u8 *)Header + OldSize) == (Arena->Base + Arena->Used)) &&
+                PushSize_(Arena, NewSize - OldSize, 1))
+            {
+               NewHeader = Header;
+            }
+            else
+            {
+               NewHeader = (buf_header *)PushSize_(Arena, NewSize, BUF_ALIGNMENT);
+               if (NewHeader)
+               {
+                  memcpy(NewHeader, Header, BUF_HEADER_SIZE + ElementSize*Header->Count);
+               }
+            }
+         }
+      }
+
+      if (NewHeader)
+      {
+         NewHeader->Capacity = (u32)Min((NewSize - BUF_HEADER_SIZE) / ElementSize, (memory_index)U32_MAX);
+         Buffer = (u8 *)NewHeader + BUF_HEADER_SIZE;
+      }
+   }
+
+   return(Buffer);
+}
+
+// NOTE (MJP): Grows so Extra more elements fit, returns false (leaving the
+// buffer as it was) when they can't.
+function b32
+BufGrowToFit_(void **Buffer, u64 Extra, memory_index ElementSize)
+{
+   u64 MinCapacity = (u64)BufHeader(*Buffer)->Count + Extra;
+   *Buffer = BufGrow_(*Buffer, MinCapacity, ElementSize);
+   b32 Result = (MinCapacity <= BufHeader(*Buffer)->Capacity);
+   return(Result);
+}
+
+// NOTE (MJP): Opens a gap of one element at Index, the caller fills it.
+function void
+BufInsertGap_(void *Buffer, u32 Index, memory_index ElementSize)
+{
+   buf_header *Header = BufHeader(Buffer);
+   Assert(Index <= Header->Count);
+   Assert(Header->Count < Header->Capacity);
+   u8 *Element = (u8 *)Buffer + ElementSize*Index;
+   memmove(Element + ElementSize, Element, ElementSize*(Header->Count - Index));
+   ++Header->Count;
+}
+
+function void
+BufRemove_(void *Buffer, u32 Index, memory_index ElementSize)
+{
+   buf_header *Header = BufHeader(Buffer);
+   Assert(Index < Header->Count);
+   u8 *Element = (u8 *)Buffer + ElementSize*Index;
+   memmove(Element, Element + ElementSize, ElementSize*(Header->Count - Index - 1));
+   --Header->Count;
+}
+
+function void
+BufFree_(void *Buffer, memory_index ElementSize)
+{
+   if (Buffer)
+   {
+      buf_header *Header = BufHeader(Buffer);
+      if (Header->ChunkAllocator)
+      {
+         FreeAllocationVoid(Header->ChunkAllocator, Header);
+      }
+      else
+      {
+         // NOTE (MJP): Only the last block in an arena can be given back.
+         memory_arena *Arena = Header->Arena;
+         u8 *End = (u8 *)Buffer + ElementSize*Header->Capacity;
+         if (End == (Arena->Base + Arena->Used))
+         {
+            ArenaPopTo(Arena, (u8 *)Header - Arena->Base);
+         }
+      }
+   }
+}
+
+#define BufAssign_(Buffer, Value) (*(void **)&(Buffer) = (Value))
+
+#define BufInit(Buffer, Allocator, Capacity) BufAssign_((Buffer), BufInit_((Allocator), (Capacity), SizeOf(*(Buffer))))
+#define BufReserve(Buffer, Capacity) BufAssign_((Buffer), BufGrow_((Buffer), (Capacity), SizeOf(*(Buffer))))
+// NOTE (MJP): True when Extra more elements fit, after growing if needed.
+#define BufFit_(Buffer, Extra) ((((u64)BufHeader(Buffer)->Count + (Extra)) <= BufHeader(Buffer)->Capacity) || \
+                                BufGrowToFit_((void **)&(Buffer), (Extra), SizeOf(*(Buffer))))
+
+// NOTE (MJP): Push, Add and Insert write nothing when the buffer can't grow.
+// Push and Insert return false then, Add returns 0.
+#define BufPush(Buffer, Value) (BufFit_((Buffer), 1) ? ((Buffer)[BufHeader(Buffer)->Count++] = (Value), true) : false)
+// NOTE (MJP): Appends Count uninitialized elements, returns the first.
+#define BufAdd(Buffer, AddCount) (BufFit_((Buffer), (AddCount)) ? \
+                                  (BufHeader(Buffer)->Count += (u32)(AddCount), BufEnd(Buffer) - (AddCount)) : 0)
+#define BufPop(Buffer) ((Buffer)[--BufHeader(Buffer)->Count])
+#define BufInsert(Buffer, Index, Value) (BufFit_((Buffer), 1) ? \
+                                         (BufInsertGap_((Buffer), (Index), SizeOf(*(Buffer))), \
+                                          (Buffer)[Index] = (Value), true) : false)
+// NOTE (MJP): Keeps order, linear in the elements after Index.
+#define BufRemove(Buffer, Index) BufRemove_((Buffer), (Index), SizeOf(*(Buffer)))
+// NOTE (MJP): Moves the last element into Index, constant time.
+#define BufRemoveSwap(Buffer, Index) ((Buffer)[Index] = (Buffer)[--BufHeader(Buffer)->Count])
+#define BufClear(Buffer) ((Buffer) ? BufHeader(Buffer)->Count = 0 : 0)
+#define BufFree(Buffer) (BufFree_((Buffer), SizeOf(*(Buffer))), BufAssign_((Buffer), 0))
+
 
 #define MJP_H
 #endif